@@ -44,13 +44,15 @@ struct tm_area {
 struct tm_context {
 	bool			should_stop;
 
+	/* Timers, X events and drawing are all handled on main thread. */
+	bool			single_thread;
+
 	bool			draw_all;
 
 	bool			init_done;
 	pthread_mutex_t		init_lock;
 	pthread_cond_t		init_cond;
 
-	struct list_head	list_update;
 	pthread_mutex_t		main_wake_lock;
 	pthread_cond_t		main_wake_cond;
 
@@ -66,6 +68,8 @@ struct tm_context {
  * @get_area: Calculate and return desiable area size.
  * @draw: Called on translated coordination. No need to worry about
  * coordination. Always guranteed that upper-left corner is the origin.
+ * @stats: Print statistics to stderr. Called periodically on event thread
+ * when --stats is given.
  */
 struct tm_object {
 	size_t		obj_size;
@@ -74,8 +78,15 @@ struct tm_object {
 	void		(*help)(struct tm_context *);
 	void		(*get_area)(struct tm_context *, struct tm_area *);
 	void		(*draw)(struct tm_context *);
+	void		(*stats)(struct tm_context *);
 };
 
+/* should_stop is read by all threads. Use tm_stop() to set it. */
+static inline bool tm_should_stop(struct tm_context *tc)
+{
+	return __atomic_load_n(&tc->should_stop, __ATOMIC_ACQUIRE);
+}
+
 static inline void *tm_get_object(struct tm_context *tc, int id)
 {
 	return (char *)tc + tc->offset[id];
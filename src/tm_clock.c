@@ -1,6 +1,8 @@
 #include "tm_main.h"
 #include "tm_x.h"
 #include "tm_thread.h"
+#include "tm_metric.h"
+#include "tm_layout.h"
 #include <sys/sysinfo.h>
 #include <stdio.h>
 #include <time.h>
@@ -65,107 +67,69 @@ out:
 	return err;
 }
 
-static void tm_clock_item_date_init(struct tm_context *tc)
-{
-	struct tm_icon *icon_clock;
-	struct tm_clock *clock;
-	double x, y, height;
-
-	clock = tm_clock(tc);
-	icon_clock = &clock->icon_clock;
-
-	height = (double)tm_x_font_max_height(tc);
+static const struct tm_layout_field layout_date[] = {
+	TM_LAYOUT_STR(TM_LAYOUT_FG)
+};
 
-	x = icon_clock->width + tm_x_margin_icon(tc);
-	y = icon_clock->height / 2.0 - height;
+/* "Uptime: XX d YY h ZZ m" */
+static const struct tm_layout_field layout_uptime[] = {
+	TM_LAYOUT_LABEL("Uptime: "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_DIGIT2, TM_METRIC_UPTIME,
+			TM_METRIC_PART_DAYS),
+	TM_LAYOUT_LABEL(" d "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_DIGIT2, TM_METRIC_UPTIME,
+			TM_METRIC_PART_HOURS),
+	TM_LAYOUT_LABEL(" h "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_DIGIT2, TM_METRIC_UPTIME,
+			TM_METRIC_PART_MINUTES),
+	TM_LAYOUT_LABEL(" m")
+};
 
-	tm_item_init(tc, &clock->item_date, TM_OBJECT_CLOCK, clock->clock_fg,
-		     &x, &y, 0, height, NULL,
-		     TM_ITEM_WIDTH_CHANGEABLE | TM_ITEM_ALIGN_LEFT);
-}
+/* "Load avg: X.XX / Y.YY / Z.ZZ" */
+static const struct tm_layout_field layout_loadavg[] = {
+	TM_LAYOUT_LABEL("Load avg: "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_LOADAVG1,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_LABEL(" / "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_LOADAVG5,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_LABEL(" / "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_LOADAVG15,
+			TM_METRIC_PART_VALUE)
+};
 
-/* "Uptime: XX d YY h ZZ m"
- *
- * "Uptime: ":	item_uptime[0]	fixed-width
- * "XX":	item_uptime[1]	2-digit, right-align
- * " d ":	item_uptime[2]	fixed-width
- * "YY":	item_uptime[3]	2-digit, right-align
- * " h ":	item_uptime[4]	fixed-width
- * "ZZ":	item_uptime[5]	2-digit, right-align
- * " m":	item_uptime[6]	fixed-width
- */
-static void tm_clock_item_uptime_init(struct tm_context *tc)
+static void tm_clock_items_init(struct tm_context *tc)
 {
-	double x, y, digit2, height;
 	struct tm_icon *icon_clock;
 	struct tm_clock *clock;
-	u32 clock_fg, clock_hi;
+	double x, y, height;
+	u32 colors[2];
 
 	clock = tm_clock(tc);
 	icon_clock = &clock->icon_clock;
 
-	clock_fg = clock->clock_fg;
-	clock_hi = clock->clock_hi;
+	colors[TM_LAYOUT_FG] = clock->clock_fg;
+	colors[TM_LAYOUT_HI] = clock->clock_hi;
 
-	digit2 = tm_x_font_max_digit_width(tc) * 2.0;
 	height = (double)tm_x_font_max_height(tc);
 
 	x = icon_clock->width + tm_x_margin_icon(tc);
-	y = icon_clock->height / 2.0;
-
-	tm_item_init(tc, &clock->item_uptime[0], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, "Uptime: ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &clock->item_uptime[1], TM_OBJECT_CLOCK, clock_hi,
-		     &x, &y, digit2, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &clock->item_uptime[2], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, " d ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &clock->item_uptime[3], TM_OBJECT_CLOCK, clock_hi,
-		     &x, &y, digit2, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &clock->item_uptime[4], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, " h ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &clock->item_uptime[5], TM_OBJECT_CLOCK, clock_hi,
-		     &x, &y, digit2, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &clock->item_uptime[6], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, " m", TM_ITEM_WIDTH_FIXED);
-}
-
-/* "Load avg: X.XX / Y.YY / Z.ZZ"
- * "Load avg: ":	item_loadavg[0]: fixed-width
- * "X.XX":		item_loadavg[1]: 3-digit+dot, right-aligned
- * " / ":		item_loadavg[2]: fixed-width
- * "Y.YY":		item_loadavg[3]: 3-digit+dot, right-aligned
- * " / ":		item_loadavg[4]: fixed-width
- * "Z.ZZ":		item_loadavg[5]: 3-digit+dor, right-aligned
- */
-static void tm_clock_item_loadavg_init(struct tm_context *tc)
-{
-	double x, y, avail, height;
-	struct tm_clock *clock;
-	u32 clock_fg, clock_hi;
-
-	clock = tm_clock(tc);
-
-	clock_fg = clock->clock_fg;
-	clock_hi = clock->clock_hi;
+	y = icon_clock->height / 2.0 - height;
+	tm_layout_apply(tc, TM_OBJECT_CLOCK, layout_date,
+			ARRAY_SIZE(layout_date), colors, NULL,
+			&clock->item_date, &x, &y);
 
-	avail = tm_x_font_dot_width(tc) + tm_x_font_max_digit_width(tc) * 3.0;
-	height = (double)tm_x_font_max_height(tc);
+	x = icon_clock->width + tm_x_margin_icon(tc);
+	y = icon_clock->height / 2.0;
+	tm_layout_apply(tc, TM_OBJECT_CLOCK, layout_uptime,
+			ARRAY_SIZE(layout_uptime), colors, NULL,
+			clock->item_uptime, &x, &y);
 
 	x = 0;
-	y = clock->icon_clock.height + tm_x_margin_icon(tc);
-
-	tm_item_init(tc, &clock->item_loadavg[0], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, "Load avg: ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &clock->item_loadavg[1], TM_OBJECT_CLOCK, clock_hi,
-		     &x, &y, avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &clock->item_loadavg[2], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, " / ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &clock->item_loadavg[3], TM_OBJECT_CLOCK, clock_hi,
-		     &x, &y, avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &clock->item_loadavg[4], TM_OBJECT_CLOCK, clock_fg,
-		     &x, &y, 0, height, " / ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &clock->item_loadavg[5], TM_OBJECT_CLOCK, clock_hi,
-		     &x, &y, avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
+	y = icon_clock->height + tm_x_margin_icon(tc);
+	tm_layout_apply(tc, TM_OBJECT_CLOCK, layout_loadavg,
+			ARRAY_SIZE(layout_loadavg), colors, NULL,
+			clock->item_loadavg, &x, &y);
 }
 
 static int tm_clock_date_update(struct tm_context *tc)
@@ -199,76 +163,22 @@ out:
 	return err;
 }
 
-static void tm_clock_item_uptime_update(struct tm_item *item, int data)
-{
-	char str[ITEM_STR_MAX];
-	int len;
-
-	len = sprintf(str, "%d", data);
-	tm_item_cmp_and_update(item, str, len);
-}
-
 static int tm_clock_uptime_update(struct tm_context *tc, long uptime)
 {
-	int days, hours, minutes;
-	struct tm_clock *clock;
-
-	clock = tm_clock(tc);
-
-	days = uptime / (24 * 60 * 60);
-	minutes = uptime / 60;
-	hours = (minutes / 60) % 24;
-	minutes %= 60;
-
-	tm_clock_item_uptime_update(&clock->item_uptime[1], days);
-	tm_clock_item_uptime_update(&clock->item_uptime[3], hours);
-	tm_clock_item_uptime_update(&clock->item_uptime[5], minutes);
+	tm_metric_set_u64(TM_METRIC_UPTIME, uptime);
 
 	return 0;
 }
 
-static int tm_clock_loadavg_str(char *s, unsigned long load)
-{
-	double ld;
-	int len;
-
-	ld = (double)load / (1 << SI_LOAD_SHIFT);
-	sprintf(s, "%.2f", ld);
-
-	if (s[3] == '.') {
-		s[3] = '\0';
-		len = 3;
-	} else {
-		s[4] = '\0';
-		len = 4;
-	}
-
-	return len;
-}
-
 static int
 tm_clock_loadavg_update(struct tm_context *tc, const unsigned long *loads)
 {
-	struct tm_clock *clock;
-	char buf[ITEM_STR_MAX];
 	int i;
 
-	clock = tm_clock(tc);
-
-	for (i = 0; i < 3; i++) {
-		struct tm_item *item;
-		int len;
-
-		if (i == 0)
-			item = &clock->item_loadavg[1];
-		else if (i == 1)
-			item = &clock->item_loadavg[3];
-		else if (i == 2)
-			item = &clock->item_loadavg[5];
-
-		len = tm_clock_loadavg_str(buf, loads[i]);
-		tm_item_cmp_and_update(item, buf, len);
-	}
+	/* loads are fixed-point with SI_LOAD_SHIFT bits of fraction. */
+	for (i = 0; i < 3; i++)
+		tm_metric_set_double(TM_METRIC_LOADAVG1 + i,
+				     (double)loads[i] / (1 << SI_LOAD_SHIFT));
 
 	return 0;
 }
@@ -322,17 +232,17 @@ static int tm_clock_init(struct tm_context *tc, int argc, char **argv)
 	err = tm_x_load_icon(tc, "icon1.svg", TM_ICON_SIDE | TM_ICON_FLIP,
 			     &clock->icon1);
 	if (err)
-		goto err;
+		goto err1;
 
 	/* Initialize items. */
-	tm_clock_item_date_init(tc);
-	tm_clock_item_uptime_init(tc);
-	tm_clock_item_loadavg_init(tc);
+	tm_clock_items_init(tc);
 
 	/* Install timer handler which checks whether uptime and loadavg are
 	 * changed or not. If changed, invoke redraw operation.
 	 */
-	tm_thread_timer_add(&timer_clock);
+	err = tm_thread_timer_add(&timer_clock);
+	if (err)
+		goto err2;
 
 	/* Force to execute timer_cb or else clock data will not be updated
 	 * until next timer expiration is occurred.
@@ -340,7 +250,9 @@ static int tm_clock_init(struct tm_context *tc, int argc, char **argv)
 	err = tm_clock_timer_cb(tc);
 out:
 	return err;
-err:
+err2:
+	tm_x_unload_icon(&clock->icon1);
+err1:
 	tm_x_unload_icon(&clock->icon_clock);
 	goto out;
 }
@@ -395,17 +307,6 @@ static void tm_clock_draw(struct tm_context *tc)
 	tm_x_draw_icon(tc, &clock->icon1,
 		       (int)(area.width - clock->icon1.width),
 		       (int)(area.height - clock->icon1.height));
-
-	/* date */
-	tm_x_draw_text_one(tc, &clock->item_date);
-
-	/* uptime */
-	tm_x_draw_text(tc, clock->item_uptime,
-		       ARRAY_SIZE(clock->item_uptime));
-
-	/* loadavg */
-	tm_x_draw_text(tc, clock->item_loadavg,
-		       ARRAY_SIZE(clock->item_loadavg));
 }
 
 static struct tm_object tm_object_clock = {
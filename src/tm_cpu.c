@@ -1,6 +1,8 @@
 #include "tm_main.h"
 #include "tm_thread.h"
 #include "tm_x.h"
+#include "tm_metric.h"
+#include "tm_layout.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -48,6 +50,15 @@ struct tm_cpu {
 
 	/* coretemp */
 	struct tm_item		item_temp[6];
+
+	/* source files */
+	struct tm_io_file	io_stat;
+	struct tm_io_file	io_temp1;
+	struct tm_io_file	io_temp2;
+	struct tm_io_file	io_drv;
+	struct tm_io_file	io_gov;
+	struct tm_io_file	*io_stat_temp[3];
+	struct tm_io_file	*io_freq[2];
 };
 
 static struct tm_cpu *tm_cpu(struct tm_context *tc)
@@ -117,72 +128,49 @@ out:
 	return err;
 }
 
-/**
- * "CPU: XX.X us Y.YY sy ZZZ id"
- *
- * "CPU: ":	item_usage[0]	fixed-width
- * "XX.X":	item_usage[1]	3-digit+dot, right-align
- * " us ":	item_usage[2]	fixed-width
- * "YY.Y":	item_usage[3]	3-digit+dot, right-align
- * " sy ":	item_usage[4]	fixed-width
- * "ZZZ":	item_usage[5]	3-digit+dot, right-align
- * " id":	item_usage[6]	fixed-width
- */
-static void tm_cpu_item_usage_init(struct tm_context *tc)
-{
-	double x, y, avail, height;
-	struct tm_icon *icon_cpu;
-	struct tm_cpu *cpu;
-	u32 cpu_fg, cpu_hi;
-
-	cpu = tm_cpu(tc);
-	icon_cpu = &cpu->icon_cpu;
-
-	cpu_fg = cpu->cpu_fg;
-	cpu_hi = cpu->cpu_hi;
-
-	avail = tm_x_font_dot_width(tc) + tm_x_font_max_digit_width(tc) * 3.0;
-	height = (double)tm_x_font_max_height(tc);
+/* "CPU: XX.X us Y.YY sy ZZZ id" */
+static const struct tm_layout_field layout_usage[] = {
+	TM_LAYOUT_LABEL("CPU: "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_CPU_US,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_LABEL(" us "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_CPU_SY,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_LABEL(" sy "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_CPU_ID,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_LABEL(" id")
+};
 
-	x = icon_cpu->width + tm_x_margin_icon(tc);
-	y = icon_cpu->height / 2.0 - height;
-
-	tm_item_init(tc, &cpu->item_usage[0], TM_OBJECT_CPU, cpu_fg, &x, &y,
-		     0, height, "CPU: ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &cpu->item_usage[1], TM_OBJECT_CPU, cpu_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &cpu->item_usage[2], TM_OBJECT_CPU, cpu_fg, &x, &y,
-		     0, height, " us ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &cpu->item_usage[3], TM_OBJECT_CPU, cpu_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &cpu->item_usage[4], TM_OBJECT_CPU, cpu_fg, &x, &y,
-		     0, height, " sy ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &cpu->item_usage[5], TM_OBJECT_CPU, cpu_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &cpu->item_usage[6], TM_OBJECT_CPU, cpu_fg, &x, &y,
-		     0, height, " id", TM_ITEM_WIDTH_FIXED);
-}
+/* "acpi-cpufreq / powersave" */
+static const struct tm_layout_field layout_freq[] = {
+	TM_LAYOUT_STR(TM_LAYOUT_FG)
+};
 
-/**
- * "acpi-cpufreq / powersave"
- *
- * "acpi-cpufreq / powersave":	item_freq:	changeable | left-align
- */
-static void tm_cpu_item_freq_init(struct tm_context *tc)
+static void tm_cpu_items_init(struct tm_context *tc)
 {
 	struct tm_icon *icon_cpu;
 	struct tm_cpu *cpu;
+	u32 colors[2];
 	double x, y;
 
 	cpu = tm_cpu(tc);
 	icon_cpu = &cpu->icon_cpu;
 
+	colors[TM_LAYOUT_FG] = cpu->cpu_fg;
+	colors[TM_LAYOUT_HI] = cpu->cpu_hi;
+
 	x = icon_cpu->width + tm_x_margin_icon(tc);
-	y = icon_cpu->height / 2.0;
+	y = icon_cpu->height / 2.0 - tm_x_font_max_height(tc);
+	tm_layout_apply(tc, TM_OBJECT_CPU, layout_usage,
+			ARRAY_SIZE(layout_usage), colors, NULL,
+			cpu->item_usage, &x, &y);
 
-	tm_item_init(tc, &cpu->item_freq, TM_OBJECT_CPU, cpu->cpu_fg, &x, &y,
-		     0, tm_x_font_max_height(tc), NULL,
-		     TM_ITEM_WIDTH_CHANGEABLE | TM_ITEM_ALIGN_LEFT);
+	x = icon_cpu->width + tm_x_margin_icon(tc);
+	y = icon_cpu->height / 2.0;
+	tm_layout_apply(tc, TM_OBJECT_CPU, layout_freq,
+			ARRAY_SIZE(layout_freq), colors, NULL,
+			&cpu->item_freq, &x, &y);
 }
 
 static int tm_cpu_item_get_one_line(const char *path, char *buf, size_t len)
@@ -215,26 +203,38 @@ out:
 	return err;
 }
 
+/* "core0: 45 ℃". Label and symbol are args. */
+static const struct tm_layout_field layout_temp1[] = {
+	TM_LAYOUT_ARG_LABEL,
+	TM_LAYOUT_VALUE(TM_LAYOUT_DIGIT2, TM_METRIC_CPU_TEMP1,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_ARG_LABEL,
+	TM_LAYOUT_ROW
+};
+
+static const struct tm_layout_field layout_temp2[] = {
+	TM_LAYOUT_ARG_LABEL,
+	TM_LAYOUT_VALUE(TM_LAYOUT_DIGIT2, TM_METRIC_CPU_TEMP2,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_ARG_LABEL,
+	TM_LAYOUT_ROW
+};
+
 static int
 tm_cpu_item_temp_init_one(const char *label, struct tm_context *tc,
+			  const struct tm_layout_field *layout,
 			  struct tm_item *item, double *x, double *y)
 {
 	char buf[32], lbl[64];
-	double height, digit2;
 	struct tm_cpu *cpu;
-	const char *symbol;
-	u32 cpu_fg, cpu_hi;
+	const char *args[2];
+	u32 colors[2];
 	int err;
 
 	cpu = tm_cpu(tc);
 
-	cpu_fg = cpu->cpu_fg;
-	cpu_hi = cpu->cpu_hi;
-
-	symbol = cpu->use_symbol ? " ℃" : " C";
-
-	digit2 = tm_x_font_max_digit_width(tc) * 2.0;
-	height = (double)tm_x_font_max_height(tc);
+	colors[TM_LAYOUT_FG] = cpu->cpu_fg;
+	colors[TM_LAYOUT_HI] = cpu->cpu_hi;
 
 	err = tm_cpu_item_get_one_line(label, buf, sizeof(buf));
 	if (err)
@@ -242,15 +242,12 @@ tm_cpu_item_temp_init_one(const char *label, struct tm_context *tc,
 
 	sprintf(lbl, "%s: ", buf);
 
-	tm_item_init(tc, &item[0], TM_OBJECT_CPU, cpu_fg, x, y,
-		     0, height, lbl, TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &item[1], TM_OBJECT_CPU, cpu_hi, x, y,
-		     digit2, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &item[2], TM_OBJECT_CPU, cpu_fg, x, y,
-		     0, height, symbol, TM_ITEM_WIDTH_FIXED);
+	args[0] = lbl;
+	args[1] = cpu->use_symbol ? " ℃" : " C";
 
-	*x = 0;
-	*y += height;
+	/* Both tables are of the same size. */
+	tm_layout_apply(tc, TM_OBJECT_CPU, layout, ARRAY_SIZE(layout_temp1),
+			colors, args, item, x, y);
 out:
 	return err;
 }
@@ -279,6 +276,7 @@ static int tm_cpu_item_temp_init(struct tm_context *tc)
 
 	if (cpu->temp_label1 && cpu->temp_input1) {
 		err = tm_cpu_item_temp_init_one(cpu->temp_label1, tc,
+						layout_temp1,
 						&cpu->item_temp[0], &x, &y);
 		if (err)
 			goto out;
@@ -286,40 +284,29 @@ static int tm_cpu_item_temp_init(struct tm_context *tc)
 
 	if (cpu->temp_label2 && cpu->temp_input2)
 		err = tm_cpu_item_temp_init_one(cpu->temp_label2, tc,
+						layout_temp2,
 						&cpu->item_temp[3], &x, &y);
 out:
 	return err;
 }
 
-static void tm_cpu_usage_update(struct tm_item *item, double usage)
+/* Percentage of @part in @total. */
+static void tm_cpu_usage_update(int metric, u64 part, u64 total)
 {
-	char buf[16];
-	int len;
-
-	len = sprintf(buf, "%.1f", usage);
-	if (buf[2] == '.') {
-		buf[4] = '\0';
-		len = 4;
-	} else {
-		buf[3] = '\0';
-		len = 3;
-	}
-
-	tm_item_cmp_and_update(item, buf, len);
+	tm_metric_set_double(metric, total ? (double)part * 100 / total : 0);
 }
 
 static int tm_cpu_item_usage_update(struct tm_context *tc)
 {
 	struct tm_cpu_stat cur, dif;
-	unsigned long long total;
+	unsigned long long total, us, sy, id;
 	struct tm_cpu *cpu;
-	double us, sy, id;
 	int err, ret, i;
 	char buf[80];
 
 	cpu = tm_cpu(tc);
 
-	err = tm_cpu_item_get_one_line("/proc/stat", buf, sizeof(buf));
+	err = tm_io_file_line(&cpu->io_stat, buf, sizeof(buf));
 	if (err)
 		goto out;
 
@@ -344,23 +331,22 @@ static int tm_cpu_item_usage_update(struct tm_context *tc)
 	 * sy: system + irq + softirq + steal
 	 * id: idle + iowait
 	 */
-	us = (double)(dif.user + dif.nice + dif.guest + dif.guest_nice) / total;
-	sy = (double)(dif.system + dif.irq + dif.softirq + dif.steal) / total;
-	id = (double)(dif.idle + dif.iowait) / total;
+	us = dif.user + dif.nice + dif.guest + dif.guest_nice;
+	sy = dif.system + dif.irq + dif.softirq + dif.steal;
+	id = dif.idle + dif.iowait;
 
-	tm_cpu_usage_update(&cpu->item_usage[1], us * 100);
-	tm_cpu_usage_update(&cpu->item_usage[3], sy * 100);
-	tm_cpu_usage_update(&cpu->item_usage[5], id * 100);
+	tm_cpu_usage_update(TM_METRIC_CPU_US, us, total);
+	tm_cpu_usage_update(TM_METRIC_CPU_SY, sy, total);
+	tm_cpu_usage_update(TM_METRIC_CPU_ID, id, total);
 
 	err = 0;
 out:
 	return err;
 }
 
-static int tm_cpu_temp_celcius_update(struct tm_item *item, char *input)
+static int tm_cpu_temp_celcius_update(int metric, char *input)
 {
-	int err, ret, cel, len;
-	char str[16];
+	int err, ret, cel;
 
 	err = 1;
 
@@ -372,8 +358,7 @@ static int tm_cpu_temp_celcius_update(struct tm_item *item, char *input)
 
 	cel /= 1000;
 
-	len = sprintf(str, "%d", cel);
-	tm_item_cmp_and_update(item, str, len);
+	tm_metric_set_double(metric, cel);
 
 	err = 0;
 out:
@@ -389,17 +374,19 @@ static int tm_cpu_item_temp_update(struct tm_context *tc)
 	cpu = tm_cpu(tc);
 
 	if (cpu->temp_label1 && cpu->temp_input1) {
-		err = tm_cpu_item_get_one_line(cpu->temp_input1, input1,
-					       sizeof(input1)) ||
-		      tm_cpu_temp_celcius_update(&cpu->item_temp[1], input1);
+		err = tm_io_file_line(&cpu->io_temp1, input1,
+				      sizeof(input1)) ||
+		      tm_cpu_temp_celcius_update(TM_METRIC_CPU_TEMP1,
+						 input1);
 		if (err)
 			goto out;
 	}
 
 	if (cpu->temp_label2 && cpu->temp_input2) {
-		err = tm_cpu_item_get_one_line(cpu->temp_input2, input2,
-					       sizeof(input2)) ||
-		      tm_cpu_temp_celcius_update(&cpu->item_temp[4], input2);
+		err = tm_io_file_line(&cpu->io_temp2, input2,
+				      sizeof(input2)) ||
+		      tm_cpu_temp_celcius_update(TM_METRIC_CPU_TEMP2,
+						 input2);
 	}
 
 out:
@@ -414,11 +401,8 @@ static int tm_cpu_item_freq_update(struct tm_context *tc)
 
 	cpu = tm_cpu(tc);
 
-#define CPU_FREQ_PATH	"/sys/devices/system/cpu/cpu0/cpufreq/"
-	err= tm_cpu_item_get_one_line(CPU_FREQ_PATH "scaling_driver",
-				      drv_str, sizeof(drv_str)) ||
-	     tm_cpu_item_get_one_line(CPU_FREQ_PATH "scaling_governor",
-				      gov_str, sizeof(gov_str));
+	err = tm_io_file_line(&cpu->io_drv, drv_str, sizeof(drv_str)) ||
+	      tm_io_file_line(&cpu->io_gov, gov_str, sizeof(gov_str));
 	if (err)
 		goto out;
 
@@ -441,14 +425,82 @@ static int tm_cpu_timer_cb_freq(struct tm_context *tc)
 
 static struct tm_thread_timer timer_cpu_stat_temp = {
 	.timer_cb	= tm_cpu_timer_cb_stat_temp,
-	.expires_msecs	= 3000
+	.expires_msecs	= 3000,
+	.max_msecs	= 24000
 };
 
 static struct tm_thread_timer timer_cpu_freq = {
 	.timer_cb	= tm_cpu_timer_cb_freq,
-	.expires_msecs	= 60000
+	.expires_msecs	= 60000,
+	.max_msecs	= 600000
 };
 
+static void tm_cpu_io_exit(struct tm_cpu *cpu)
+{
+	int i;
+
+	for (i = 0; i < timer_cpu_stat_temp.nr_io_files; i++)
+		tm_io_file_close(cpu->io_stat_temp[i]);
+	timer_cpu_stat_temp.nr_io_files = 0;
+
+	for (i = 0; i < timer_cpu_freq.nr_io_files; i++)
+		tm_io_file_close(cpu->io_freq[i]);
+	timer_cpu_freq.nr_io_files = 0;
+}
+
+/* Source files are kept open, and read by event thread on behalf of us. */
+static int tm_cpu_io_init(struct tm_cpu *cpu)
+{
+	struct tm_thread_timer *st, *fr;
+	int err;
+
+	st = &timer_cpu_stat_temp;
+	fr = &timer_cpu_freq;
+	st->io_files = cpu->io_stat_temp;
+	fr->io_files = cpu->io_freq;
+
+	err = tm_io_file_open(&cpu->io_stat, "/proc/stat");
+	if (err)
+		goto out;
+	st->io_files[st->nr_io_files++] = &cpu->io_stat;
+
+	if (cpu->temp_label1 && cpu->temp_input1) {
+		err = tm_io_file_open(&cpu->io_temp1, cpu->temp_input1);
+		if (err)
+			goto err;
+		st->io_files[st->nr_io_files++] = &cpu->io_temp1;
+	}
+
+	if (cpu->temp_label2 && cpu->temp_input2) {
+		err = tm_io_file_open(&cpu->io_temp2, cpu->temp_input2);
+		if (err)
+			goto err;
+		st->io_files[st->nr_io_files++] = &cpu->io_temp2;
+	}
+
+#define CPU_FREQ_PATH	"/sys/devices/system/cpu/cpu0/cpufreq/"
+	err = tm_io_file_open(&cpu->io_drv, CPU_FREQ_PATH "scaling_driver");
+	if (err)
+		goto err;
+	fr->io_files[fr->nr_io_files++] = &cpu->io_drv;
+
+	err = tm_io_file_open(&cpu->io_gov, CPU_FREQ_PATH "scaling_governor");
+	if (err)
+		goto err;
+	fr->io_files[fr->nr_io_files++] = &cpu->io_gov;
+
+	/* For the first sample below. */
+	err = tm_io_pread(st->io_files, st->nr_io_files) ||
+	      tm_io_pread(fr->io_files, fr->nr_io_files);
+	if (err)
+		goto err;
+out:
+	return err;
+err:
+	tm_cpu_io_exit(cpu);
+	goto out;
+}
+
 static int tm_cpu_init(struct tm_context *tc, int argc, char **argv)
 {
 	struct tm_cpu *cpu;
@@ -475,18 +527,29 @@ static int tm_cpu_init(struct tm_context *tc, int argc, char **argv)
 	if (err)
 		goto err1;
 
-	tm_cpu_item_usage_init(tc);
-	tm_cpu_item_freq_init(tc);
+	tm_cpu_items_init(tc);
 	err = tm_cpu_item_temp_init(tc);
 	if (err)
 		goto err2;
 
-	tm_thread_timer_add(&timer_cpu_stat_temp);
-	tm_thread_timer_add(&timer_cpu_freq);
+	err = tm_cpu_io_init(cpu);
+	if (err)
+		goto err2;
+
+	err = tm_thread_timer_add(&timer_cpu_stat_temp);
+	if (err)
+		goto err3;
+	err = tm_thread_timer_add(&timer_cpu_freq);
+	if (err)
+		goto err4;
 
 	err = tm_cpu_timer_cb_stat_temp(tc) || tm_cpu_timer_cb_freq(tc);
 out:
 	return err;
+err4:
+	tm_thread_timer_del(&timer_cpu_stat_temp);
+err3:
+	tm_cpu_io_exit(cpu);
 err2:
 	tm_x_unload_icon(&cpu->icon2);
 err1:
@@ -502,6 +565,7 @@ static void tm_cpu_exit(struct tm_context *tc)
 
 	tm_thread_timer_del(&timer_cpu_freq);
 	tm_thread_timer_del(&timer_cpu_stat_temp);
+	tm_cpu_io_exit(cpu);
 
 	tm_x_unload_icon(&cpu->icon2);
 	tm_x_unload_icon(&cpu->icon_cpu);
@@ -549,15 +613,6 @@ static void tm_cpu_draw(struct tm_context *tc)
 	tm_x_draw_icon(tc, &cpu->icon2,
 		       (int)(area.width - cpu->icon2.width),
 		       (int)(area.height - cpu->icon2.height));
-
-	/* usage */
-	tm_x_draw_text(tc, cpu->item_usage, ARRAY_SIZE(cpu->item_usage));
-
-	/* freq */
-	tm_x_draw_text_one(tc, &cpu->item_freq);
-
-	/* temp */
-	tm_x_draw_text(tc, cpu->item_temp, ARRAY_SIZE(cpu->item_temp));
 }
 
 static struct tm_object tm_object_cpu = {
@@ -1,6 +1,8 @@
 #include "tm_main.h"
 #include "tm_x.h"
 #include "tm_thread.h"
+#include "tm_metric.h"
+#include "tm_layout.h"
 #include "tm_item.h"
 #include <sys/vfs.h>
 #include <stdio.h>
@@ -93,56 +95,45 @@ out:
 	return err;
 }
 
-/**
- * "/ (ext4): XXX GiB / YYY GiB"
- *
- * "/ (ext4): "	item_disk[0]	fixed-width
- * "XXX":	item_disk[1]	3-digit+dot, right-align
- * " GiB":	item_disk[2]	fixed-width(max-unit-width)
- * " / ":	item_disk[3]	fixed-width
- * "YYY":	item_disk[4]	3-digit+dot, right-align
- * " GiB":	item_disk[5]	fixed-width(max-unit-width)
- */
+/* "/ (ext4): XXX GiB / YYY GiB". The mount point is an arg. */
+static const struct tm_layout_field layout_disk[] = {
+	TM_LAYOUT_ARG_LABEL,
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_DISK_USED,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_IB, TM_METRIC_DISK_USED),
+	TM_LAYOUT_LABEL(" / "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_DISK_TOTAL,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_IB, TM_METRIC_DISK_TOTAL)
+};
+
 static int tm_disk_item_disk_init(struct tm_context *tc)
 {
-	double x, y, avail, ut_wid, height;
 	struct tm_icon *icon_disk;
 	struct tm_disk *disk;
-	u32 disk_fg, disk_hi;
+	const char *args[1];
 	char mtpt_str[64];
+	u32 colors[2];
+	double x, y;
 	int err;
 
 	disk = tm_disk(tc);
 	icon_disk = &disk->icon_disk;
 
-	disk_fg = disk->disk_fg;
-	disk_hi = disk->disk_hi;
-
-	avail = tm_x_font_dot_width(tc) + tm_x_font_max_digit_width(tc) * 3.0;
-	height = (double)tm_x_font_max_height(tc);
+	colors[TM_LAYOUT_FG] = disk->disk_fg;
+	colors[TM_LAYOUT_HI] = disk->disk_hi;
 
 	x = icon_disk->width + tm_x_margin_icon(tc);
-	y = icon_disk->height / 2.0 - height;
-
-	tm_x_text_size(tc, " iB", 3, &ut_wid, NULL);
-	ut_wid += (double)tm_x_font_max_unit_width(tc);
+	y = icon_disk->height / 2.0 - tm_x_font_max_height(tc);
 
 	err = tm_disk_getfs(disk->mount_point, mtpt_str);
 	if (err)
 		goto out;
 
-	tm_item_init(tc, &disk->item_disk[0], TM_OBJECT_DISK, disk_fg, &x, &y,
-		     0, height, mtpt_str, TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &disk->item_disk[1], TM_OBJECT_DISK, disk_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &disk->item_disk[2], TM_OBJECT_DISK, disk_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
-	tm_item_init(tc, &disk->item_disk[3], TM_OBJECT_DISK, disk_fg, &x, &y,
-		     0, height, " / ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &disk->item_disk[4], TM_OBJECT_DISK, disk_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &disk->item_disk[5], TM_OBJECT_DISK, disk_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
+	args[0] = mtpt_str;
+	tm_layout_apply(tc, TM_OBJECT_DISK, layout_disk,
+			ARRAY_SIZE(layout_disk), colors, args,
+			disk->item_disk, &x, &y);
 out:
 	return err;
 }
@@ -166,17 +157,19 @@ static int tm_disk_timer_cb(struct tm_context *tc)
 	used = (buf.f_blocks - buf.f_bfree) * buf.f_bsize;
 	total = buf.f_blocks * buf.f_bsize;
 
-	tm_item_data_unit_update(&disk->item_disk[1], &disk->item_disk[2],
-				 (double)used);
-	tm_item_data_unit_update(&disk->item_disk[4], &disk->item_disk[5],
-				 (double)total);
+	tm_metric_set_u64(TM_METRIC_DISK_USED, used);
+	tm_metric_set_u64(TM_METRIC_DISK_TOTAL, total);
 out:
 	return err;
 }
 
 static struct tm_thread_timer timer_disk = {
 	.timer_cb	= tm_disk_timer_cb,
-	.expires_msecs	= 10000
+	.expires_msecs	= 10000,
+	.max_msecs	= 160000,
+	/* statfs may hang on network or FUSE mounts. */
+	.flags		= TM_THREAD_TIMER_ISOLATED,
+	.timeout_msecs	= 2000
 };
 
 static int tm_disk_init(struct tm_context *tc, int argc, char **argv)
@@ -210,7 +203,11 @@ static int tm_disk_init(struct tm_context *tc, int argc, char **argv)
 		goto err2;
 
 	/* Arm timer handler. */
-	tm_thread_timer_add(&timer_disk);
+	timer_disk.items = disk->item_disk;
+	timer_disk.nr_items = ARRAY_SIZE(disk->item_disk);
+	err = tm_thread_timer_add(&timer_disk);
+	if (err)
+		goto err2;
 
 	err = tm_disk_timer_cb(tc);
 out:
@@ -271,9 +268,6 @@ static void tm_disk_draw(struct tm_context *tc)
 	tm_x_draw_icon(tc, &disk->icon4,
 		       (int)(area.width - disk->icon4.width),
 		       (int)(area.height - disk->icon4.height));
-
-	/* fs usage */
-	tm_x_draw_text(tc, disk->item_disk, ARRAY_SIZE(disk->item_disk));
 }
 
 static struct tm_object tm_object_disk = {
@@ -0,0 +1,165 @@
+#include "tm_fmt.h"
+#include <string.h>
+
+static const u64 tm_fmt_pow10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL
+};
+
+#define TM_FMT_FRAC_MAX	18
+
+static int tm_fmt_nr_digits(u64 val)
+{
+	int n;
+
+	for (n = 1; n < 20 && val >= tm_fmt_pow10[n]; n++)
+		;
+
+	return n;
+}
+
+/* Print @val, with a dot before the last @frac digits. */
+static int tm_fmt_emit(char *buf, u64 val, int frac)
+{
+	int nr, len, i;
+
+	nr = tm_fmt_nr_digits(val);
+	if (nr <= frac)
+		nr = frac + 1;
+
+	len = nr + (frac ? 1 : 0);
+	buf[len] = '\0';
+
+	for (i = len - 1; i >= 0; i--) {
+		if (frac && i == len - 1 - frac) {
+			buf[i] = '.';
+			continue;
+		}
+		buf[i] = '0' + val % 10;
+		val /= 10;
+	}
+
+	return len;
+}
+
+/* Drop the last @drop digits of @val, rounding half up. */
+static u64 tm_fmt_round(u64 val, int drop)
+{
+	u64 p;
+
+	if (!drop)
+		return val;
+
+	p = tm_fmt_pow10[drop];
+
+	return val / p + (val % p >= p / 2);
+}
+
+u64 tm_fmt_fixed_quantum(u64 val, int frac, int width, int *keep)
+{
+	int drop;
+
+	if (frac > TM_FMT_FRAC_MAX)
+		frac = TM_FMT_FRAC_MAX;
+
+	for (drop = 0; drop < frac; drop++) {
+		int k;
+		u64 v;
+
+		/* Rounding may carry into the integer part, so look at the
+		 * rounded value.
+		 */
+		v = tm_fmt_round(val, drop);
+		k = frac - drop;
+
+		if (tm_fmt_nr_digits(v / tm_fmt_pow10[k]) + 1 + k <= width) {
+			*keep = k;
+			return v;
+		}
+	}
+
+	*keep = 0;
+
+	return tm_fmt_round(val, frac);
+}
+
+int tm_fmt_fixed(char *buf, u64 val, int frac, int width)
+{
+	int keep;
+
+	val = tm_fmt_fixed_quantum(val, frac, width, &keep);
+
+	return tm_fmt_emit(buf, val, keep);
+}
+
+/* @val / @div in hundredths, rounded. */
+static u64 tm_fmt_div_centi(u64 val, u64 div)
+{
+	u64 q, r;
+
+	q = val / div;
+	r = val % div;
+
+	/* Keep r * 100 from overflowing. Error is far below a hundredth. */
+	if (div > ~0ULL / 128) {
+		r >>= 7;
+		div >>= 7;
+	}
+
+	return q * 100 + (r * 100 + div / 2) / div;
+}
+
+u64 tm_fmt_scale(u64 val, unsigned int base, int *prefix)
+{
+	int p, max;
+	u64 div, centi;
+
+	max = sizeof(TM_FMT_PREFIXES) - 2;
+	div = 1;
+
+	for (p = 0; p < max && val / div >= 1000; p++)
+		div *= base;
+
+	for (;;) {
+		centi = tm_fmt_div_centi(val, div);
+
+		/* 999.95 and above would be rounded up to "1000". */
+		if (centi < 99950 || p == max)
+			break;
+
+		div *= base;
+		p++;
+	}
+
+	*prefix = p;
+
+	return centi;
+}
+
+int tm_fmt_scaled(char *buf, u64 val, unsigned int base, int *prefix)
+{
+	return tm_fmt_fixed(buf, tm_fmt_scale(val, base, prefix), 2, 4);
+}
+
+int tm_fmt_unit(char *buf, int prefix, bool iec, const char *suffix)
+{
+	size_t len;
+	int n;
+
+	n = 0;
+	buf[n++] = ' ';
+	if (prefix) {
+		buf[n++] = TM_FMT_PREFIXES[prefix];
+		if (iec)
+			buf[n++] = 'i';
+	}
+
+	len = strlen(suffix);
+	memcpy(buf + n, suffix, len + 1);
+
+	return n + len;
+}
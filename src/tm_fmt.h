@@ -0,0 +1,36 @@
+#ifndef _TM_FMT_H
+#define _TM_FMT_H
+
+#include "tm_types.h"
+
+/**
+ * Number formatting for items, without sprintf and locale. Each returns the
+ * length of the string written to @buf, which is always NUL-terminated.
+ *
+ * tm_fmt_fixed: @val is a fixed-point number with @frac decimal digits, e.g.
+ * 1234 with @frac 2 is 12.34. The integer part is always printed in full,
+ * and as many fractional digits as fit within @width characters follow,
+ * rounded half up. @buf needs 24 bytes.
+ *
+ * tm_fmt_scaled: Scale @val by @base (1000 for SI, 1024 for IEC) until it
+ * drops below 1000, and print it with 3 significant digits in at most 4
+ * characters. The prefix index into TM_FMT_PREFIXES is stored to @prefix.
+ *
+ * tm_fmt_fixed_quantum, tm_fmt_scale: The numbers behind the above, without
+ * printing. tm_fmt_fixed_quantum() returns the rounded digits that would be
+ * printed, with the number of fractional ones in @keep, so that two values
+ * print the same string if and only if both match. tm_fmt_scale() returns
+ * the scaled value in hundredths.
+ *
+ * tm_fmt_unit: " " followed by the prefix (and "i" for IEC) and @suffix,
+ * e.g. " MiB", " kbps" or " B".
+ */
+#define TM_FMT_PREFIXES	" kMGTPE"
+
+extern int tm_fmt_fixed(char *buf, u64 val, int frac, int width);
+extern int tm_fmt_scaled(char *buf, u64 val, unsigned int base, int *prefix);
+extern u64 tm_fmt_fixed_quantum(u64 val, int frac, int width, int *keep);
+extern u64 tm_fmt_scale(u64 val, unsigned int base, int *prefix);
+extern int tm_fmt_unit(char *buf, int prefix, bool iec, const char *suffix);
+
+#endif /* _TM_FMT_H */
@@ -0,0 +1,112 @@
+/* Microbenchmark of tm_fmt against the sprintf path it replaced.
+ *
+ *	make tm_fmt_bench && ./tm_fmt_bench [ITERATIONS]
+ */
+#include "tm_fmt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_VALUES	1024
+
+static u64 values[NR_VALUES];
+static volatile int sink;
+
+/* What tm_item_data_unit_update() used to do. */
+static int tm_fmt_bench_sprintf(char *str, char *unit, u64 val)
+{
+	const char *units, *p;
+	double data;
+	int len;
+
+	units = p = " kMGTPE";
+	data = (double)val;
+
+	while (data >= 1000) {
+		data /= 1024.0;
+		p++;
+	}
+
+	sprintf(str, "%.2f", data);
+	if (str[3] == '.') {
+		str[3] = '\0';
+		len = 3;
+	} else {
+		str[4] = '\0';
+		len = 4;
+	}
+
+	if (p == units)
+		len += sprintf(unit, " B");
+	else
+		len += sprintf(unit, " %ciB", *p);
+
+	return len;
+}
+
+static int tm_fmt_bench_fmt(char *str, char *unit, u64 val)
+{
+	int len, prefix;
+
+	len = tm_fmt_scaled(str, val, 1024, &prefix);
+	len += tm_fmt_unit(unit, prefix, true, "B");
+
+	return len;
+}
+
+static double tm_fmt_bench_run(int (*fn)(char *, char *, u64), long iters)
+{
+	char str[24], unit[24];
+	u64 start;
+	long i;
+	int sum;
+
+	sum = 0;
+	start = tm_now();
+	for (i = 0; i < iters; i++)
+		sum += fn(str, unit, values[i % NR_VALUES]);
+	sink = sum;
+
+	return (double)(tm_now() - start) / iters;
+}
+
+int main(int argc, char **argv)
+{
+	double ns_sprintf, ns_fmt;
+	long iters;
+	int i, nr_diff;
+
+	iters = argc > 1 ? atol(argv[1]) : 10000000;
+	if (iters <= 0) {
+		fprintf(stderr, "Usage: %s [ITERATIONS]\n", argv[0]);
+		return 1;
+	}
+
+	/* Spread over all magnitudes, like memory, disk and traffic do. */
+	srand(1);
+	for (i = 0; i < NR_VALUES; i++)
+		values[i] = (u64)rand() << (rand() % 32);
+
+	/* sprintf path chopped the last digit off instead of rounding it, and
+	 * printed 999.995 and above as "1000". Count where they disagree.
+	 */
+	nr_diff = 0;
+	for (i = 0; i < NR_VALUES; i++) {
+		char s1[24], u1[24], s2[24], u2[24];
+
+		tm_fmt_bench_sprintf(s1, u1, values[i]);
+		tm_fmt_bench_fmt(s2, u2, values[i]);
+		if (strcmp(s1, s2) || strcmp(u1, u2))
+			nr_diff++;
+	}
+
+	ns_sprintf = tm_fmt_bench_run(tm_fmt_bench_sprintf, iters);
+	ns_fmt = tm_fmt_bench_run(tm_fmt_bench_fmt, iters);
+
+	printf("sprintf: %.1f ns/op\n", ns_sprintf);
+	printf("tm_fmt:  %.1f ns/op\n", ns_fmt);
+	printf("speedup: %.1fx, %d/%d outputs differ\n", ns_sprintf / ns_fmt,
+	       nr_diff, NR_VALUES);
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+#include "tm_glyph.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Each object has a couple of colors, and each of them a dimmed one for
+ * stale items.
+ */
+#define TM_GLYPH_ATLAS_MAX	32
+
+struct tm_glyph_cell {
+	int			x;
+	int			width;
+};
+
+static struct tm_glyph_atlas {
+	u32			col;
+	cairo_surface_t		*surface;
+} atlases[TM_GLYPH_ATLAS_MAX];
+
+static int nr_atlases;
+
+/* Index into cells by character, or -1. */
+static signed char cell_idx[128];
+static struct tm_glyph_cell cells[sizeof(TM_GLYPH_CHARS) - 1];
+static int atlas_width;
+static int atlas_height;
+
+/* Renders atlases. A copy of the layout tm_glyph_init() is given. */
+static PangoLayout *glyph_layout;
+
+/* For stats. */
+static u64 nr_draws;
+static u64 nr_cells;
+
+void tm_glyph_init(PangoLayout *layout)
+{
+	const char *p;
+	int i, x;
+
+	memset(cell_idx, -1, sizeof(cell_idx));
+
+	glyph_layout = pango_layout_copy(layout);
+
+	x = 0;
+	for (p = TM_GLYPH_CHARS, i = 0; *p; p++, i++) {
+		int width, height;
+
+		pango_layout_set_text(glyph_layout, p, 1);
+		pango_layout_get_pixel_size(glyph_layout, &width, &height);
+
+		cell_idx[(int)*p] = i;
+		cells[i].x = x;
+		cells[i].width = width;
+
+		x += width;
+		if (atlas_height < height)
+			atlas_height = height;
+	}
+	atlas_width = x;
+}
+
+void tm_glyph_exit(void)
+{
+	int i;
+
+	for (i = 0; i < nr_atlases; i++)
+		cairo_surface_destroy(atlases[i].surface);
+	nr_atlases = 0;
+
+	if (glyph_layout)
+		g_object_unref(glyph_layout);
+	glyph_layout = NULL;
+}
+
+static cairo_surface_t *tm_glyph_atlas_create(u32 col)
+{
+	cairo_surface_t *surface;
+	const char *p;
+	cairo_t *cr;
+	int i;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, atlas_width,
+					     atlas_height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	cr = cairo_create(surface);
+	cairo_set_source_rgb(cr, ((col >> 16) & 0xff) / 255.0,
+			     ((col >> 8) & 0xff) / 255.0, (col & 0xff) / 255.0);
+	pango_cairo_update_layout(cr, glyph_layout);
+
+	for (p = TM_GLYPH_CHARS, i = 0; *p; p++, i++) {
+		pango_layout_set_text(glyph_layout, p, 1);
+		cairo_move_to(cr, cells[i].x, 0);
+		pango_cairo_show_layout(cr, glyph_layout);
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+
+	return surface;
+}
+
+static struct tm_glyph_atlas *tm_glyph_atlas(u32 col)
+{
+	int i;
+
+	for (i = 0; i < nr_atlases; i++) {
+		if (atlases[i].col == col)
+			return &atlases[i];
+	}
+
+	return NULL;
+}
+
+int tm_glyph_add_color(u32 col)
+{
+	struct tm_glyph_atlas *atlas;
+
+	if (tm_glyph_atlas(col))
+		return 0;
+
+	if (nr_atlases >= TM_GLYPH_ATLAS_MAX)
+		return ENOSPC;
+
+	atlas = &atlases[nr_atlases];
+	atlas->surface = tm_glyph_atlas_create(col);
+	if (!atlas->surface)
+		return ENOMEM;
+
+	atlas->col = col;
+	nr_atlases++;
+
+	return 0;
+}
+
+int tm_glyph_width(u32 col, const char *str, size_t len)
+{
+	size_t i;
+	int width;
+
+	width = 0;
+	for (i = 0; i < len; i++) {
+		unsigned char c;
+
+		c = str[i];
+		if (c >= sizeof(cell_idx) || cell_idx[c] < 0)
+			return -1;
+
+		width += cells[(int)cell_idx[c]].width;
+	}
+
+	if (!tm_glyph_atlas(col))
+		return -1;
+
+	return width;
+}
+
+void tm_glyph_draw(cairo_t *cr, u32 col, double x, double y,
+		   const char *str, size_t len)
+{
+	struct tm_glyph_atlas *atlas;
+	size_t i;
+
+	atlas = tm_glyph_atlas(col);
+
+	/* Cells copied to fractional positions would get blurred. */
+	x = floor(x + 0.5);
+	y = floor(y + 0.5);
+
+	for (i = 0; i < len; i++) {
+		struct tm_glyph_cell *cell;
+
+		cell = &cells[(int)cell_idx[(unsigned char)str[i]]];
+
+		cairo_set_source_surface(cr, atlas->surface, x - cell->x, y);
+		cairo_rectangle(cr, x, y, cell->width, atlas_height);
+		cairo_fill(cr);
+
+		x += cell->width;
+	}
+
+	nr_draws++;
+	nr_cells += len;
+}
+
+void tm_glyph_stats(void)
+{
+	fprintf(stderr, "glyph: %d atlases, %llu runs, %llu cells\n",
+		nr_atlases, (unsigned long long)nr_draws,
+		(unsigned long long)nr_cells);
+}
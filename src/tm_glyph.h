@@ -0,0 +1,34 @@
+#ifndef _TM_GLYPH_H
+#define _TM_GLYPH_H
+
+#include "tm_types.h"
+#include <pango/pangocairo.h>
+
+/**
+ * Pre-rendered glyphs for numeric items, which are nearly all of updates:
+ * digits, '.', and units made of TM_FMT_PREFIXES, "iB" and "bps". Each
+ * glyph is shaped once by Pango into a cell of an atlas per color at
+ * startup, and such text is drawn by copying cells, without shaping at all.
+ *
+ * tm_glyph_init: Measure TM_GLYPH_CHARS with the font of @layout.
+ *
+ * tm_glyph_add_color: Render the atlas of @col. Returns 0, or errno.
+ *
+ * tm_glyph_width: Width of @str in pixels, or -1 if it has a character
+ * out of TM_GLYPH_CHARS, or @col has no atlas. Then draw it with Pango
+ * instead. Kerning between cells is not applied.
+ *
+ * tm_glyph_draw: Draw @str, which tm_glyph_width() has accepted, at @x, @y
+ * of @cr in user space, rounded to pixels.
+ */
+#define TM_GLYPH_CHARS	" .0123456789kMGTPEiBbps"
+
+extern void tm_glyph_init(PangoLayout *layout);
+extern void tm_glyph_exit(void);
+extern int tm_glyph_add_color(u32 col);
+extern int tm_glyph_width(u32 col, const char *str, size_t len);
+extern void tm_glyph_draw(cairo_t *cr, u32 col, double x, double y,
+			  const char *str, size_t len);
+extern void tm_glyph_stats(void);
+
+#endif /* _TM_GLYPH_H */
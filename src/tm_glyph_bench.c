@@ -0,0 +1,128 @@
+/* Per-frame cost of drawing numeric items with Pango against the glyph
+ * atlas, into an image surface like the back buffer.
+ *
+ *	make tm_glyph_bench && ./tm_glyph_bench [FRAMES] [FONT]
+ */
+#include "tm_glyph.h"
+#include "tm_fmt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* About as many numeric items as all objects have. */
+#define NR_ITEMS	24
+#define NR_VALUES	1024
+
+static char values[NR_VALUES][24];
+static int lens[NR_VALUES];
+
+/* What tm_x_draw_text() does for a changed item without the atlas. */
+static void tm_glyph_bench_pango(cairo_t *cr, PangoLayout *layout, int i,
+				 double y)
+{
+	int width;
+
+	pango_layout_set_text(layout, values[i], lens[i]);
+	pango_layout_get_pixel_size(layout, &width, NULL);
+	cairo_set_source_rgb(cr, 0.5, 0.4, 0);
+	cairo_move_to(cr, 200 - width, y);
+	pango_cairo_show_layout(cr, layout);
+}
+
+static void tm_glyph_bench_atlas(cairo_t *cr, PangoLayout *layout, int i,
+				 double y)
+{
+	int width;
+
+	width = tm_glyph_width(0x806600, values[i], lens[i]);
+	tm_glyph_draw(cr, 0x806600, 200 - width, y, values[i], lens[i]);
+}
+
+static double
+tm_glyph_bench_run(void (*fn)(cairo_t *, PangoLayout *, int, double),
+		   cairo_t *cr, PangoLayout *layout, long frames)
+{
+	u64 start;
+	long f;
+	int i;
+
+	start = tm_now();
+	for (f = 0; f < frames; f++) {
+		/* Clear, as the back buffer is before items are drawn. */
+		cairo_set_source_rgb(cr, 1, 0.96, 0.84);
+		cairo_paint(cr);
+
+		for (i = 0; i < NR_ITEMS; i++)
+			fn(cr, layout, (f * NR_ITEMS + i) % NR_VALUES,
+			   (i % 12) * 30);
+		cairo_surface_flush(cairo_get_target(cr));
+	}
+
+	return (double)(tm_now() - start) / frames;
+}
+
+int main(int argc, char **argv)
+{
+	PangoFontDescription *desc;
+	cairo_surface_t *surface;
+	double ns_pango, ns_atlas;
+	PangoLayout *layout;
+	const char *font;
+	cairo_t *cr;
+	long frames;
+	int i;
+
+	frames = argc > 1 ? atol(argv[1]) : 10000;
+	font = argc > 2 ? argv[2] : "sans-serif bold 18";
+	if (frames <= 0) {
+		fprintf(stderr, "Usage: %s [FRAMES] [FONT]\n", argv[0]);
+		return 1;
+	}
+
+	/* Half values, half units, as items of memory, disk and net are. */
+	srand(1);
+	for (i = 0; i < NR_VALUES; i++) {
+		int prefix;
+
+		if (i & 1)
+			lens[i] = tm_fmt_unit(values[i], rand() % 7, i & 2,
+					      i & 2 ? "B" : "bps");
+		else
+			lens[i] = tm_fmt_scaled(values[i],
+						(u64)rand() << (rand() % 32),
+						1024, &prefix);
+	}
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 500, 400);
+	cr = cairo_create(surface);
+	cairo_surface_destroy(surface);
+
+	layout = pango_cairo_create_layout(cr);
+	desc = pango_font_description_from_string(font);
+	pango_layout_set_font_description(layout, desc);
+	pango_font_description_free(desc);
+
+	tm_glyph_init(layout);
+	if (tm_glyph_add_color(0x806600)) {
+		fprintf(stderr, "Can't render glyph atlas.\n");
+		return 1;
+	}
+
+	/* Warm up font caches. */
+	tm_glyph_bench_run(tm_glyph_bench_pango, cr, layout, 10);
+	tm_glyph_bench_run(tm_glyph_bench_atlas, cr, layout, 10);
+
+	ns_pango = tm_glyph_bench_run(tm_glyph_bench_pango, cr, layout, frames);
+	ns_atlas = tm_glyph_bench_run(tm_glyph_bench_atlas, cr, layout, frames);
+
+	printf("pango: %.1f us/frame\n", ns_pango / 1000);
+	printf("atlas: %.1f us/frame\n", ns_atlas / 1000);
+	printf("speedup: %.1fx, %d items/frame\n", ns_pango / ns_atlas,
+	       NR_ITEMS);
+
+	tm_glyph_exit();
+	g_object_unref(layout);
+	cairo_destroy(cr);
+
+	return 0;
+}
@@ -0,0 +1,307 @@
+#include "tm_io.h"
+#include "tm_main.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+static LIST_HEAD(file_head);
+
+/* For stats. */
+static u64 nr_reads;
+static u64 nr_syscalls;
+
+#ifdef HAVE_LIBURING
+/* All reads of a tick are submitted and waited for by one io_uring_enter. */
+#define TM_IO_RING_ENTRIES	32
+static struct io_uring ring;
+static bool ring_ready;
+static bool files_registered;
+#endif
+
+int tm_io_file_open(struct tm_io_file *file, const char *path)
+{
+	int err;
+
+	err = 0;
+
+	file->path = path;
+	file->len = 0;
+	file->buf[0] = '\0';
+	file->fixed = -1;
+
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (file->fd == -1) {
+		err = errno;
+		fprintf(stderr, "%s: ", path);
+		pr_err("open");
+		goto out;
+	}
+
+	list_add_tail(&file->list, &file_head);
+out:
+	return err;
+}
+
+void tm_io_file_close(struct tm_io_file *file)
+{
+	if (file->fd == -1)
+		return;
+
+	list_del_init(&file->list);
+	close(file->fd);
+	file->fd = -1;
+}
+
+static int tm_io_complete(struct tm_io_file *file, ssize_t len)
+{
+	file->len = len;
+	__atomic_fetch_add(&nr_reads, 1, __ATOMIC_RELAXED);
+
+	if (len < 0) {
+		file->buf[0] = '\0';
+		fprintf(stderr, "%s: read: %s\n", file->path, strerror(-len));
+		return 1;
+	}
+
+	file->buf[len] = '\0';
+
+	return 0;
+}
+
+int tm_io_pread(struct tm_io_file **files, int nr_files)
+{
+	int i, err;
+
+	err = 0;
+
+	for (i = 0; i < nr_files; i++) {
+		struct tm_io_file *file;
+		ssize_t len;
+
+		file = files[i];
+
+		len = pread(file->fd, file->buf, sizeof(file->buf) - 1, 0);
+		__atomic_fetch_add(&nr_syscalls, 1, __ATOMIC_RELAXED);
+		err |= tm_io_complete(file, len == -1 ? -errno : len);
+	}
+
+	return err;
+}
+
+#ifdef HAVE_LIBURING
+/* Whatever @files hold is from the last read. Don't let it pass for new. */
+static void tm_io_fail(struct tm_io_file **files, int nr_files, int err)
+{
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		files[i]->len = -err;
+		files[i]->buf[0] = '\0';
+	}
+}
+
+static int tm_io_uring_read(struct tm_io_file **files, int nr_files)
+{
+	int i, err, nr, done;
+
+	err = 0;
+
+	for (done = 0; done < nr_files; done += nr) {
+		struct io_uring_cqe *cqe;
+		int ret;
+
+		nr = nr_files - done;
+		if (nr > TM_IO_RING_ENTRIES)
+			nr = TM_IO_RING_ENTRIES;
+
+		for (i = 0; i < nr; i++) {
+			struct io_uring_sqe *sqe;
+			struct tm_io_file *file;
+
+			file = files[done + i];
+
+			sqe = io_uring_get_sqe(&ring);
+			if (file->fixed >= 0) {
+				io_uring_prep_read(sqe, file->fixed, file->buf,
+						   sizeof(file->buf) - 1, 0);
+				sqe->flags |= IOSQE_FIXED_FILE;
+			} else {
+				io_uring_prep_read(sqe, file->fd, file->buf,
+						   sizeof(file->buf) - 1, 0);
+			}
+			io_uring_sqe_set_data(sqe, file);
+		}
+
+		ret = io_uring_submit_and_wait(&ring, nr);
+		__atomic_fetch_add(&nr_syscalls, 1, __ATOMIC_RELAXED);
+		if (ret < 0) {
+			errno = -ret;
+			pr_err("io_uring_submit_and_wait");
+			tm_io_fail(files + done, nr_files - done, -ret);
+			err = 1;
+			break;
+		}
+
+		/* Parse each as it comes. All of them are here already. */
+		for (i = 0; i < nr; i++) {
+			ret = io_uring_peek_cqe(&ring, &cqe);
+			if (ret < 0) {
+				errno = -ret;
+				pr_err("io_uring_peek_cqe");
+				/* Some of them may be done, but we don't know
+				 * which.
+				 */
+				tm_io_fail(files + done, nr_files - done, -ret);
+				err = 1;
+				goto out;
+			}
+
+			err |= tm_io_complete(io_uring_cqe_get_data(cqe),
+					      cqe->res);
+			io_uring_cqe_seen(&ring, cqe);
+		}
+	}
+out:
+	return err;
+}
+#endif
+
+int tm_io_read(struct tm_io_file **files, int nr_files)
+{
+	if (!nr_files)
+		return 0;
+
+#ifdef HAVE_LIBURING
+	if (ring_ready)
+		return tm_io_uring_read(files, nr_files);
+#endif
+	return tm_io_pread(files, nr_files);
+}
+
+int tm_io_file_line(struct tm_io_file *file, char *buf, size_t len)
+{
+	const char *p;
+	size_t n;
+
+	if (file->len <= 0) {
+		fprintf(stderr, "Can't read from %s.\n", file->path);
+		return 1;
+	}
+
+	p = strchr(file->buf, '\n');
+	n = p ? p - file->buf : file->len;
+	if (n >= len)
+		n = len - 1;
+
+	memcpy(buf, file->buf, n);
+	buf[n] = '\0';
+
+	return 0;
+}
+
+#ifdef HAVE_LIBURING
+/* Register files opened so far, so that the kernel doesn't look up fd
+ * every time. Files opened later are read by fd.
+ */
+static void tm_io_register_files(void)
+{
+	struct tm_io_file *file;
+	int nr, err, *fds;
+
+	nr = 0;
+	list_for_each_entry(file, &file_head, list)
+		nr++;
+
+	if (!nr)
+		return;
+
+	fds = malloc(sizeof(*fds) * nr);
+	if (!fds) {
+		pr_err("malloc");
+		return;
+	}
+
+	nr = 0;
+	list_for_each_entry(file, &file_head, list)
+		fds[nr++] = file->fd;
+
+	err = io_uring_register_files(&ring, fds, nr);
+	free(fds);
+	if (err < 0) {
+		errno = -err;
+		pr_err("io_uring_register_files");
+		return;
+	}
+
+	nr = 0;
+	list_for_each_entry(file, &file_head, list)
+		file->fixed = nr++;
+
+	files_registered = true;
+}
+#endif
+
+/* Falling back to pread is not an error. */
+int tm_io_init(bool use_uring)
+{
+#ifdef HAVE_LIBURING
+	int err;
+
+	if (!use_uring)
+		goto out;
+
+	err = io_uring_queue_init(TM_IO_RING_ENTRIES, &ring, 0);
+	if (err < 0) {
+		errno = -err;
+		pr_err("io_uring_queue_init");
+		goto out;
+	}
+
+	tm_io_register_files();
+	ring_ready = true;
+out:
+#endif
+	return 0;
+}
+
+void tm_io_exit(void)
+{
+#ifdef HAVE_LIBURING
+	struct tm_io_file *file;
+
+	if (!ring_ready)
+		return;
+
+	if (files_registered) {
+		io_uring_unregister_files(&ring);
+		list_for_each_entry(file, &file_head, list)
+			file->fixed = -1;
+		files_registered = false;
+	}
+
+	io_uring_queue_exit(&ring);
+	ring_ready = false;
+#endif
+}
+
+void tm_io_stats(void)
+{
+	const char *backend;
+
+	backend = "pread";
+#ifdef HAVE_LIBURING
+	if (ring_ready)
+		backend = "io_uring";
+#endif
+
+	fprintf(stderr, "io: %s, %llu reads, %llu syscalls\n", backend,
+		(unsigned long long)__atomic_load_n(&nr_reads, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&nr_syscalls,
+						    __ATOMIC_RELAXED));
+}
@@ -0,0 +1,42 @@
+#ifndef _TM_IO_H
+#define _TM_IO_H
+
+#include "tm.h"
+#include <sys/types.h>
+
+/**
+ * Source files (procfs, sysfs) are kept open, and read again from offset 0
+ * each time, so that a sample doesn't cost open/close.
+ *
+ * @path: Path of the file.
+ * @len: Bytes read by the last tm_io_read(), or -errno.
+ * @buf: Contents read by the last tm_io_read(). Always NUL-terminated.
+ *
+ * Others are work area. Never touch!
+ * @fd: Kept open until tm_io_file_close().
+ * @fixed: Index in the files registered to io_uring, or -1.
+ */
+struct tm_io_file {
+	struct list_head	list;
+	const char		*path;
+	ssize_t			len;
+#define TM_IO_BUF_SIZE	4096
+	char			buf[TM_IO_BUF_SIZE];
+
+	int			fd;
+	int			fixed;
+};
+
+extern int tm_io_file_open(struct tm_io_file *file, const char *path);
+extern void tm_io_file_close(struct tm_io_file *file);
+/* Read all @files at once. Only event loop may call this. */
+extern int tm_io_read(struct tm_io_file **files, int nr_files);
+/* Same as above, but without io_uring. Safe on any thread. */
+extern int tm_io_pread(struct tm_io_file **files, int nr_files);
+/* Copy the first line of @file into @buf. */
+extern int tm_io_file_line(struct tm_io_file *file, char *buf, size_t len);
+extern int tm_io_init(bool use_uring);
+extern void tm_io_exit(void);
+extern void tm_io_stats(void);
+
+#endif /* _TM_IO_H */
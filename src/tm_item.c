@@ -1,90 +1,293 @@
 #include "tm_item.h"
+#include "tm_main.h"
 #include "tm_x.h"
+#include "tm_metric.h"
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
 
-static LIST_HEAD(list_update);
+struct tm_item_arena tm_items __attribute__((aligned(64)));
 
-static void tm_item_update_add(struct tm_item *item)
+/* Changed items are published to main thread through a bounded MPSC ring.
+ * Timers may run in parallel on workers and executors, so any thread may
+ * produce, and only main thread consumes. Each slot carries a sequence
+ * number which tells whether it is free for the producer at @tail (seq ==
+ * pos) or filled for the consumer at @head (seq == pos + 1).
+ */
+#define TM_ITEM_RING_SIZE	256
+
+static struct tm_item_slot {
+	u32			seq;
+	u32			idx;
+} ring[TM_ITEM_RING_SIZE];
+
+static u32 ring_head;
+static u32 ring_tail;
+
+/* The ring was full and some item was dropped. Main thread draws all. */
+static bool ring_lost;
+
+/* Backing store of long texts. Bumped and never freed, see tm_item_text. */
+#define TM_ITEM_STR_ARENA_SIZE	4096
+
+static char str_arena[TM_ITEM_STR_ARENA_SIZE];
+static u32 str_arena_used;
+
+/* Counted per thread, so that a timer can tell whether its own timer_cb
+ * changed anything.
+ */
+static __thread unsigned long nr_updates;
+
+unsigned long tm_item_nr_updates(void)
 {
-	list_add_tail(&item->list, &list_update);
+	return nr_updates;
 }
 
-bool tm_item_update_needed(void)
+__attribute__((constructor))
+static void tm_item_ring_init(void)
 {
-	return !list_empty(&list_update);
+	u32 i;
+
+	for (i = 0; i < TM_ITEM_RING_SIZE; i++)
+		ring[i].seq = i;
 }
 
-void tm_item_update_replace(struct list_head *head)
+static bool tm_item_ring_push(int idx)
 {
-	list_replace_init(&list_update, head);
+	struct tm_item_slot *slot;
+	u32 pos, seq;
+
+	pos = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &ring[pos % TM_ITEM_RING_SIZE];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&ring_tail, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if ((int)(seq - pos) < 0) {
+			return false;
+		} else {
+			pos = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->idx = idx;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
 }
 
-void tm_item_cmp_and_update(struct tm_item *item, const char *str, int len)
+void tm_item_update_add(int idx)
 {
-	if (len >= ITEM_STR_MAX) {
-		fprintf(stderr, "%s(%d): str is too long (%d).\n", __func__,
-			__LINE__, len);
-		len = ITEM_STR_MAX - 1;
-	}
-	if (strcmp(item->str, str)) {
-		strncpy(item->str, str, len);
-		item->str[len] = '\0';
-		item->len = len;
-		tm_item_update_add(item);
+	nr_updates++;
+
+	/* Already queued, and not drawn yet. It will be drawn with the latest
+	 * contents.
+	 */
+	if (__atomic_exchange_n(&tm_items.dirty[idx], 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (!tm_item_ring_push(idx)) {
+		__atomic_store_n(&tm_items.dirty[idx], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&ring_lost, true, __ATOMIC_RELEASE);
 	}
 }
 
-void tm_item_data_unit_update(struct tm_item *item_data,
-			      struct tm_item *item_unit, double data)
+bool tm_item_update_needed(void)
 {
-	const char *units, *p;
-	char str[16];
-	int len;
+	return __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) !=
+	       __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) ||
+	       __atomic_load_n(&ring_lost, __ATOMIC_ACQUIRE);
+}
 
-	units = p = " kMGTPE";
+/* Pop the index of the next changed item, or -1 if nothing is left. The
+ * item is then clean, so a change from now on queues it again.
+ */
+int tm_item_update_next(void)
+{
+	struct tm_item_slot *slot;
+	u32 pos;
+	int idx;
 
-	while (data >= 1000) {
-		data /= 1024.0;
-		p++;
-	}
+	pos = ring_head;
+	slot = &ring[pos % TM_ITEM_RING_SIZE];
 
-	sprintf(str, "%.2f", data);
-	if (str[3] == '.') {
-		str[3] = '\0';
-		len = 3;
-	} else {
-		str[4] = '\0';
-		len = 4;
-	}
+	/* Empty, or the producer has not finished filling it yet. It wakes us
+	 * up again once done.
+	 */
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return -1;
+
+	idx = slot->idx;
+	__atomic_store_n(&slot->seq, pos + TM_ITEM_RING_SIZE, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring_head, pos + 1, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&tm_items.dirty[idx], 0, __ATOMIC_SEQ_CST);
+
+	tm_metric_format(idx);
+
+	return idx;
+}
 
-	tm_item_cmp_and_update(item_data, str, len);
+bool tm_item_update_lost(void)
+{
+	return __atomic_exchange_n(&ring_lost, false, __ATOMIC_ACQ_REL);
+}
+
+/* A reader racing with the first long text may see new len before ext, and
+ * gets NULL then. Pairs with the release in tm_item_text_ext().
+ */
+static char *tm_item_text_str(struct tm_item_text *text, size_t len)
+{
+	return len < ITEM_STR_INLINE ? text->str :
+	       __atomic_load_n(&text->ext, __ATOMIC_ACQUIRE);
+}
 
-	if (p == units)
-		len = sprintf(str, " B");
+/* Copy a consistent snapshot of the text, which may be rewritten by its
+ * collector meanwhile. @str must have ITEM_STR_MAX bytes.
+ */
+size_t tm_item_read(int idx, char *str)
+{
+	struct tm_item_text *text;
+	size_t len;
+	char *src;
+	u32 seq;
+
+	text = &tm_items.text[idx];
+	src = NULL;
+
+	do {
+		seq = __atomic_load_n(&text->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		len = __atomic_load_n(&text->len, __ATOMIC_RELAXED);
+		if (len >= ITEM_STR_MAX)
+			len = ITEM_STR_MAX - 1;
+		src = tm_item_text_str(text, len);
+		if (src)
+			memcpy(str, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (!src || (seq & 1) ||
+		 seq != __atomic_load_n(&text->seq, __ATOMIC_RELAXED));
+
+	str[len] = '\0';
+
+	return len;
+}
+
+/* Take a buffer for long text of @text from the arena. Only its writer may
+ * call this. Returns false if the arena is used up, which is told only once
+ * since collectors retry every tick.
+ */
+static bool tm_item_text_ext(struct tm_item_text *text)
+{
+	static bool warned;
+	u32 off;
+
+	if (text->ext)
+		return true;
+
+	off = __atomic_load_n(&str_arena_used, __ATOMIC_RELAXED);
+	do {
+		if (off + ITEM_STR_MAX > sizeof(str_arena)) {
+			if (!__atomic_exchange_n(&warned, true,
+						 __ATOMIC_RELAXED))
+				fprintf(stderr, "%s(%d): no room for long str. "
+					"Truncated.\n", __func__, __LINE__);
+			return false;
+		}
+	} while (!__atomic_compare_exchange_n(&str_arena_used, &off,
+					      off + ITEM_STR_MAX, true,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	__atomic_store_n(&text->ext, &str_arena[off], __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* Replace the text without drawing it. Only its writer may call this. */
+bool tm_item_set_str(int idx, const char *str, int len)
+{
+	struct tm_item_text *text;
+
+	text = &tm_items.text[idx];
+
+	if (len >= ITEM_STR_MAX)
+		len = ITEM_STR_MAX - 1;
+
+	if (len >= ITEM_STR_INLINE && !tm_item_text_ext(text))
+		len = ITEM_STR_INLINE - 1;
+
+	/* Compare after truncation, or a long one looks changed every time. */
+	if (text->len == len &&
+	    !memcmp(tm_item_text_str(text, len), str, len))
+		return false;
+
+	__atomic_store_n(&text->seq, text->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(tm_item_text_str(text, len), str, len);
+	text->len = len;
+	__atomic_store_n(&text->seq, text->seq + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void tm_item_cmp_and_update(struct tm_item *item, const char *str, int len)
+{
+	if (tm_item_set_str(item->idx, str, len))
+		tm_item_update_add(item->idx);
+}
+
+void tm_item_set_stale(struct tm_item *item, bool stale)
+{
+	u32 old, *flags;
+
+	flags = &tm_items.flags[item->idx];
+
+	if (stale)
+		old = __atomic_fetch_or(flags, TM_ITEM_STALE, __ATOMIC_RELAXED);
 	else
-		len = sprintf(str, " %ciB", *p);
-	tm_item_cmp_and_update(item_unit, str, len);
+		old = __atomic_fetch_and(flags, ~TM_ITEM_STALE,
+					 __ATOMIC_RELAXED);
+
+	/* Redraw it only when it actually changed. */
+	if (!!(old & TM_ITEM_STALE) != stale)
+		tm_item_update_add(item->idx);
 }
 
+/* Allocate @item from the arena. Called on init only. */
 void tm_item_init(struct tm_context *tc, struct tm_item *item, int id, u32 fg,
 		  double *x, double *y, double width, double height,
 		  const char *str, u32 flags)
 {
+	struct tm_item_text *text;
 	double wid;
+	int idx;
+
+	if (tm_items.nr >= TM_ITEM_MAX) {
+		fprintf(stderr, "%s: too many items.\n", __func__);
+		panic();
+	}
+
+	idx = tm_items.nr++;
+	item->idx = idx;
+	text = &tm_items.text[idx];
 
 	wid = width;
 
-	*item = (struct tm_item) {
-		.id	= id,
-		.flags	= flags,
-		.fg	= fg,
-		.x	= *x,
-		.y	= *y,
-		.width	= width,
-		.height	= height
-	};
+	tm_items.id[idx] = id;
+	tm_items.flags[idx] = flags;
+	tm_items.fg[idx] = fg;
+	tm_items.x[idx] = *x;
+	tm_items.y[idx] = *y;
+	tm_items.width[idx] = width;
+	tm_items.height[idx] = height;
 
 	if (str) {
 		size_t len;
@@ -95,15 +298,29 @@ void tm_item_init(struct tm_context *tc, struct tm_item *item, int id, u32 fg,
 				__func__, __LINE__, len);
 			len = ITEM_STR_MAX - 1;
 		}
-		strncpy(item->str, str, len);
-		item->str[len] = '\0';
-		item->len = len;
+		tm_item_set_str(idx, str, len);
+		len = text->len;
 
-		if (flags & TM_ITEM_WIDTH_FIXED) {
+		/* Unless the caller has measured it already. */
+		if ((flags & TM_ITEM_WIDTH_FIXED) && !width) {
 			tm_x_text_size(tc, str, len, &wid, NULL);
-			item->width = wid;
+			tm_items.width[idx] = wid;
 		}
 	}
 
 	*x += wid;
 }
+
+/* Make geometry of items of object @id absolute, once its origin is known. */
+void tm_item_set_origin(int id, double x, double y)
+{
+	int i;
+
+	for (i = 0; i < tm_items.nr; i++) {
+		if (tm_items.id[i] != id)
+			continue;
+
+		tm_items.x[i] += x;
+		tm_items.y[i] += y;
+	}
+}
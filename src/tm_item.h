@@ -16,39 +16,99 @@
  * contents. These bits control position of the space.
  * No need to set TM_ITEM_ALIGN_LEFT bit explicitly, since left-aligned is
  * default alignment.
+ *
+ * @TM_ITEM_STALE: Its collector is stuck. The contents is drawn dimmed. Set
+ * via tm_item_set_stale().
  */
 enum {
 	TM_ITEM_WIDTH_FIXED		= (1 << 0),
 	TM_ITEM_WIDTH_CHANGEABLE	= (1 << 1),
 	TM_ITEM_ALIGN_LEFT		= (1 << 2),
-	TM_ITEM_ALIGN_RIGHT		= (1 << 3)
+	TM_ITEM_ALIGN_RIGHT		= (1 << 3),
+	TM_ITEM_STALE			= (1 << 4)
 };
 
+/**
+ * Items of all objects live in one arena, tm_items. Objects only hold a
+ * handle to each of theirs, and pass it to the functions below.
+ */
 struct tm_item {
-	struct list_head	list;
-	int			id;
-	u32			flags;
-#if 0
-	u32			bg;
-#endif
-	u32			fg;
-	double			x;
-	double			y;
-	double			width;
-	double			height;
-	size_t			len;
-#define ITEM_STR_MAX	32
-	char			str[ITEM_STR_MAX];
+	u16			idx;
+};
+
+#define TM_ITEM_MAX	128
+/* Longest text of an item, including NUL. */
+#define ITEM_STR_MAX	128
+/* Text shorter than this is kept inline. */
+#define ITEM_STR_INLINE	24
+
+/**
+ * Written by collectors on any thread, and read by main thread.
+ *
+ * @seq: Odd while the text is being rewritten. Readers go through
+ * tm_item_read().
+ * @len: Length of the text, which is in @str if shorter than
+ * ITEM_STR_INLINE, or in @ext otherwise.
+ * @ext: ITEM_STR_MAX bytes from the string arena, taken the first time the
+ * text gets long, and kept for good. So a long text never allocates again,
+ * and the buffer stays valid for readers in the middle of a frame.
+ */
+struct tm_item_text {
+	u32			seq;
+	u32			len;
+	char			*ext;
+	char			str[ITEM_STR_INLINE];
 };
 
+/**
+ * Structure of arrays indexed by tm_item::idx, so that drawing walks each
+ * of them linearly. Items of an object are contiguous, in the order of
+ * tm_item_init().
+ *
+ * @x, @y, @width, @height: Geometry. Relative to the object at init, and
+ * absolute in the window after tm_item_set_origin(). @width of
+ * TM_ITEM_WIDTH_CHANGEABLE is updated by main thread as drawn.
+ * @flags, @fg, @id: Style, and TM_OBJECT_* owning the item.
+ * @metric, @metric_part: Set by tm_metric_bind(). The text is then
+ * formatted from the metric right before drawing.
+ * @dirty: Set while the item is queued for drawing, so that it is queued at
+ * most once per frame.
+ */
+struct tm_item_arena {
+	double			x[TM_ITEM_MAX];
+	double			y[TM_ITEM_MAX];
+	double			width[TM_ITEM_MAX];
+	double			height[TM_ITEM_MAX];
+
+	u32			flags[TM_ITEM_MAX] __attribute__((aligned(64)));
+	u32			fg[TM_ITEM_MAX];
+	u8			id[TM_ITEM_MAX];
+
+	u16			metric[TM_ITEM_MAX] __attribute__((aligned(64)));
+	u8			metric_part[TM_ITEM_MAX];
+	u32			dirty[TM_ITEM_MAX] __attribute__((aligned(64)));
+
+	struct tm_item_text	text[TM_ITEM_MAX] __attribute__((aligned(64)));
+
+	int			nr;
+};
+
+extern struct tm_item_arena tm_items;
+
 extern bool tm_item_update_needed(void);
-extern void tm_item_update_replace(struct list_head *head);
+extern unsigned long tm_item_nr_updates(void);
+/* Only main thread may call these two. */
+extern int tm_item_update_next(void);
+extern bool tm_item_update_lost(void);
+extern size_t tm_item_read(int idx, char *str);
+extern void tm_item_update_add(int idx);
+extern bool tm_item_set_str(int idx, const char *str, int len);
 extern void tm_item_cmp_and_update(struct tm_item *item, const char *str, int
 				   len);
-extern void tm_item_data_unit_update(struct tm_item *item_data,
-				     struct tm_item *item_unit, double data);
+extern void tm_item_set_stale(struct tm_item *item, bool stale);
 extern void tm_item_init(struct tm_context *tc, struct tm_item *item, int id,
 			 u32 fg, double *x, double *y, double width,
 			 double height, const char *str, u32 flags);
+extern void tm_item_set_origin(int id, double x, double y);
 
 #endif /* _TM_ITEM_H */
@@ -0,0 +1,134 @@
+#include "tm_layout.h"
+#include "tm_main.h"
+#include "tm_x.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Each tm_x_text_size() lays the shared PangoLayout out again. Labels such
+ * as " / " repeat across panels, so remember what has been measured.
+ */
+#define TM_LAYOUT_MEMO_MAX	32
+
+static struct tm_layout_memo {
+	char			str[ITEM_STR_INLINE];
+	double			width;
+} memo[TM_LAYOUT_MEMO_MAX];
+
+static int nr_memo;
+
+/* For stats. */
+static u64 nr_lookups;
+static u64 nr_measured;
+
+static double tm_layout_text_width(struct tm_context *tc, const char *s)
+{
+	struct tm_layout_memo *m;
+	double width;
+	size_t len;
+	int i;
+
+	nr_lookups++;
+
+	for (i = 0; i < nr_memo; i++) {
+		if (!strcmp(memo[i].str, s))
+			return memo[i].width;
+	}
+
+	len = strlen(s);
+	tm_x_text_size(tc, s, len, &width, NULL);
+	nr_measured++;
+
+	/* Too long or too many. Not worth remembering. */
+	if (len >= ITEM_STR_INLINE || nr_memo >= TM_LAYOUT_MEMO_MAX)
+		return width;
+
+	m = &memo[nr_memo++];
+	memcpy(m->str, s, len + 1);
+	m->width = width;
+
+	return width;
+}
+
+static double tm_layout_width(struct tm_context *tc,
+			      const struct tm_layout_field *f,
+			      const char *label)
+{
+	switch (f->width) {
+	case TM_LAYOUT_TEXT:
+	case TM_LAYOUT_ARG:
+		return label ? tm_layout_text_width(tc, label) : 0;
+	case TM_LAYOUT_FIT:
+		return tm_layout_text_width(tc, f->fit);
+	case TM_LAYOUT_DIGIT2:
+		return tm_x_font_max_digit_width(tc) * 2.0;
+	case TM_LAYOUT_NUMBER:
+		return tm_x_font_dot_width(tc) +
+		       tm_x_font_max_digit_width(tc) * 3.0;
+	case TM_LAYOUT_UNIT_IB:
+		return tm_layout_text_width(tc, " iB") +
+		       tm_x_font_max_unit_width(tc);
+	case TM_LAYOUT_UNIT_BPS:
+		return tm_layout_text_width(tc, " bps") +
+		       tm_x_font_max_unit_width(tc);
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Resolve @fields into @items of object @id, from (*@x, *@y) on. Each field
+ * but TM_LAYOUT_NEWLINE takes one item, in order. On return, *@x and *@y
+ * point right after the last field. Returns the number of items used.
+ */
+int tm_layout_apply(struct tm_context *tc, int id,
+		    const struct tm_layout_field *fields, int nr_fields,
+		    const u32 *colors, const char **args,
+		    struct tm_item *items, double *x, double *y)
+{
+	double x0, height;
+	int i, nr;
+
+	x0 = *x;
+	height = (double)tm_x_font_max_height(tc);
+	nr = 0;
+
+	for (i = 0; i < nr_fields; i++) {
+		const struct tm_layout_field *f;
+		const char *label;
+		u32 flags;
+
+		f = &fields[i];
+
+		if (f->width == TM_LAYOUT_NEWLINE) {
+			*x = x0;
+			*y += height;
+			continue;
+		}
+
+		label = f->width == TM_LAYOUT_ARG ? *args++ : f->label;
+
+		flags = f->flags;
+		if (f->width == TM_LAYOUT_CHANGEABLE)
+			flags |= TM_ITEM_WIDTH_CHANGEABLE;
+		else if (label && f->width != TM_LAYOUT_FIT)
+			flags |= TM_ITEM_WIDTH_FIXED;
+
+		tm_item_init(tc, &items[nr], id, colors[f->color], x, y,
+			     tm_layout_width(tc, f, label), height, label,
+			     flags);
+
+		if (f->metric != TM_METRIC_NONE)
+			tm_metric_bind(f->metric, &items[nr], f->part);
+
+		nr++;
+	}
+
+	return nr;
+}
+
+void tm_layout_stats(void)
+{
+	fprintf(stderr, "layout: %llu text lookups, %llu measured\n",
+		(unsigned long long)nr_lookups,
+		(unsigned long long)nr_measured);
+}
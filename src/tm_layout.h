@@ -0,0 +1,92 @@
+#ifndef _TM_LAYOUT_H
+#define _TM_LAYOUT_H
+
+#include "tm.h"
+#include "tm_item.h"
+#include "tm_metric.h"
+
+/**
+ * Width of a field.
+ *
+ * @TM_LAYOUT_TEXT: Width of its label.
+ * @TM_LAYOUT_ARG: Same as above, but the label is only known at runtime.
+ * It is taken from the args of tm_layout_apply() in order.
+ * @TM_LAYOUT_FIT: Width of tm_layout_field::fit, so that labels of
+ * different lengths line up.
+ * @TM_LAYOUT_CHANGEABLE: Follows the contents. See TM_ITEM_WIDTH_CHANGEABLE.
+ * @TM_LAYOUT_DIGIT2: "99".
+ * @TM_LAYOUT_NUMBER: 3 digits and a dot, "99.9".
+ * @TM_LAYOUT_UNIT_IB: The widest of " B", " kiB", ... " EiB".
+ * @TM_LAYOUT_UNIT_BPS: The widest of " bps", " kbps", ... " Ebps".
+ * @TM_LAYOUT_NEWLINE: Not a field. Continue on the next row, at the x the
+ * table started at.
+ */
+enum {
+	TM_LAYOUT_TEXT,
+	TM_LAYOUT_ARG,
+	TM_LAYOUT_FIT,
+	TM_LAYOUT_CHANGEABLE,
+	TM_LAYOUT_DIGIT2,
+	TM_LAYOUT_NUMBER,
+	TM_LAYOUT_UNIT_IB,
+	TM_LAYOUT_UNIT_BPS,
+	TM_LAYOUT_NEWLINE
+};
+
+/* Color of a field, picked from the colors of tm_layout_apply(). */
+enum {
+	TM_LAYOUT_FG,
+	TM_LAYOUT_HI
+};
+
+/**
+ * One field of a panel. Tables of these are static const, so that a panel
+ * is described once, and resolved into items by tm_layout_apply().
+ *
+ * @label: Static text, or NULL for a value.
+ * @fit: See TM_LAYOUT_FIT.
+ * @width: TM_LAYOUT_*.
+ * @flags: TM_ITEM_ALIGN_*.
+ * @color: TM_LAYOUT_FG or TM_LAYOUT_HI.
+ * @metric, @part: The metric shown, see tm_metric_bind(). TM_METRIC_NONE if
+ * the object updates the text itself.
+ */
+struct tm_layout_field {
+	const char	*label;
+	const char	*fit;
+	u8		width;
+	u8		flags;
+	u8		color;
+	u8		metric;
+	u8		part;
+};
+
+#define TM_LAYOUT_LABEL(__label)					\
+	{ .label = (__label), .width = TM_LAYOUT_TEXT,			\
+	  .color = TM_LAYOUT_FG }
+#define TM_LAYOUT_ARG_LABEL						\
+	{ .width = TM_LAYOUT_ARG, .color = TM_LAYOUT_FG }
+#define TM_LAYOUT_FIT_LABEL(__label, __fit)				\
+	{ .label = (__label), .fit = (__fit), .width = TM_LAYOUT_FIT,	\
+	  .flags = TM_ITEM_ALIGN_RIGHT, .color = TM_LAYOUT_FG }
+/* Text the object updates itself. */
+#define TM_LAYOUT_STR(__color)						\
+	{ .width = TM_LAYOUT_CHANGEABLE, .flags = TM_ITEM_ALIGN_LEFT,	\
+	  .color = (__color) }
+#define TM_LAYOUT_VALUE(__width, __metric, __part)			\
+	{ .width = (__width), .flags = TM_ITEM_ALIGN_RIGHT,		\
+	  .color = TM_LAYOUT_HI, .metric = (__metric), .part = (__part) }
+#define TM_LAYOUT_UNIT(__width, __metric)				\
+	{ .width = (__width), .flags = TM_ITEM_ALIGN_LEFT,		\
+	  .color = TM_LAYOUT_FG, .metric = (__metric),			\
+	  .part = TM_METRIC_PART_UNIT }
+#define TM_LAYOUT_ROW							\
+	{ .width = TM_LAYOUT_NEWLINE }
+
+extern int tm_layout_apply(struct tm_context *tc, int id,
+			   const struct tm_layout_field *fields, int nr_fields,
+			   const u32 *colors, const char **args,
+			   struct tm_item *items, double *x, double *y);
+extern void tm_layout_stats(void);
+
+#endif /* _TM_LAYOUT_H */
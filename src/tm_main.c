@@ -1,11 +1,14 @@
 #include "tm_thread.h"
 #include "tm_main.h"
 #include "tm_x.h"
+#include "tm_layout.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <limits.h>
 
 void __panic(const char *func, int line)
 {
@@ -33,6 +36,22 @@ void __pr_err(const char *func, int line, const char *s, int eno)
 	free(p);
 }
 
+/* Integer argument @s of option @opt, within [@min, @max]. */
+int tm_parse_num(const char *opt, const char *s, long min, long max,
+		 long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtol(s, &end, 10);
+	if (end == s || *end || errno || *val < min || *val > max) {
+		fprintf(stderr, "%s: invalid argument: %s\n", opt, s);
+		return 1;
+	}
+
+	return 0;
+}
+
 /* For used with cairo_translate. */
 struct tm_origin {
 	double	x;
@@ -40,7 +59,20 @@ struct tm_origin {
 };
 
 struct tm_main {
+	/* User configuration variable. */
+	int			stats_secs;
+	int			frame_window;	/* in milliseconds */
+	int			max_fps;
+
 	struct tm_origin	origin[TM_OBJECT_MAX];
+
+	/* Frame scheduling. Under main_wake_lock. */
+	u64			dirty_since;
+	u64			last_frame;
+
+	/* For stats. */
+	u64			nr_frames;
+	u64			nr_frame_items;
 };
 
 static struct tm_main *tm_main(struct tm_context *tc)
@@ -96,6 +128,9 @@ static void tm_draw_all(struct tm_context *tc)
 	margin_icon = tm_x_margin_icon(tc);
 	old_y = 0;
 
+	/* Separator lines are not covered by any item or icon. */
+	tm_x_damage_all(tc);
+
 	for (i = 0; i < TM_OBJECT_MAX; i++) {
 		struct tm_object *o;
 		double x, y;
@@ -120,39 +155,174 @@ static void tm_draw_all(struct tm_context *tc)
 
 		old_y = y;
 	}
+
+	/* Items of all objects at once, in absolute coordinates. */
+	tm_x_draw_items(tc, 0, tm_items.nr);
 }
 
-static void tm_draw_list(struct tm_context *tc, struct list_head *head)
+/* Draw items straight off the update ring. */
+static int tm_draw_updates(struct tm_context *tc)
+{
+	int idx, nr;
+
+	nr = 0;
+
+	while ((idx = tm_item_update_next()) >= 0) {
+		tm_x_draw_item(tc, idx);
+		nr++;
+	}
+
+	return nr;
+}
+
+/* Ask all threads to stop, and wake them up right away so that they do not
+ * sleep until their next event. Only valid after all objects are initialized.
+ */
+void tm_stop(struct tm_context *tc)
+{
+	/* Someone has already done this. */
+	if (__atomic_exchange_n(&tc->should_stop, true, __ATOMIC_ACQ_REL))
+		return;
+
+	pthread_mutex_lock(&tc->main_wake_lock);
+	pthread_cond_signal(&tc->main_wake_cond);
+	pthread_mutex_unlock(&tc->main_wake_lock);
+
+	tm_thread_wake(tc);
+	tm_x_wake(tc);
+}
+
+/* Draw what has been updated since last call, and flush.
+ * Returns true if anything is drawn.
+ */
+bool tm_draw(struct tm_context *tc)
 {
-	struct tm_item *item;
 	struct tm_main *ta;
+	bool draw_all;
+	int nr;
 
 	ta = tm_main(tc);
 
-	list_for_each_entry(item, head, list) {
-		double x, y;
-		int id;
+	pthread_mutex_lock(&tc->main_wake_lock);
+	draw_all = tc->draw_all;
+	if (tc->draw_all)
+		tc->draw_all = false;
+
+	ta->dirty_since = 0;
+	pthread_mutex_unlock(&tc->main_wake_lock);
+
+	if (tm_item_update_lost())
+		draw_all = true;
+
+	if (draw_all) {
+		/* Everything is drawn anyway. Just mark them clean. */
+		while (tm_item_update_next() >= 0)
+			;
+		tm_draw_all(tc);
+	} else {
+		nr = tm_draw_updates(tc);
+		if (!nr)
+			return false;
+		ta->nr_frame_items += nr;
+	}
 
-		id = item->id;
+	ta->last_frame = tm_now();
 
-		x = ta->origin[id].x;
-		y = ta->origin[id].y;
+	tm_x_flush(tc);
+	ta->nr_frames++;
 
-		tm_x_translate(tc, x, y);
-		tm_x_draw_text_one(tc, item);
-		tm_x_translate(tc, -x, -y);
+	return true;
+}
+
+/* When the pending frame should be drawn, or 0 if nothing is pending.
+ * Updates arriving within frame_window are drawn in one frame, and frames
+ * are not drawn more often than max_fps. Called with main_wake_lock held.
+ */
+static u64 tm_frame_due(struct tm_context *tc)
+{
+	struct tm_main *ta;
+	u64 due;
+
+	ta = tm_main(tc);
+
+	if (!tm_item_update_needed() && !tc->draw_all) {
+		ta->dirty_since = 0;
+		return 0;
+	}
+
+	if (!ta->dirty_since)
+		ta->dirty_since = tm_now();
+
+	due = ta->dirty_since + ta->frame_window * NSEC_PER_MSEC;
+	if (ta->max_fps > 0 && due < ta->last_frame + NSEC_PER_SEC / ta->max_fps)
+		due = ta->last_frame + NSEC_PER_SEC / ta->max_fps;
+
+	return due;
+}
+
+/* For event loop in single thread mode. Returns milliseconds until the next
+ * frame, 0 if it is due now, or -1 if nothing is pending.
+ */
+int tm_frame_timeout(struct tm_context *tc)
+{
+	u64 due, now;
+	int timeout;
+
+	pthread_mutex_lock(&tc->main_wake_lock);
+	due = tm_frame_due(tc);
+	pthread_mutex_unlock(&tc->main_wake_lock);
+
+	if (!due)
+		return -1;
+
+	now = tm_now();
+	if (due <= now)
+		return 0;
+
+	/* Round up, so that we don't wake up too early and spin. */
+	timeout = (due - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+
+	return timeout;
+}
+
+/* Sleep until a frame is due, or we are asked to stop. */
+static void tm_frame_wait(struct tm_context *tc)
+{
+	u64 due;
+
+	pthread_mutex_lock(&tc->main_wake_lock);
+	while (!tm_should_stop(tc)) {
+		struct timespec ts;
+
+		due = tm_frame_due(tc);
+		if (!due) {
+			pthread_cond_wait(&tc->main_wake_cond,
+					  &tc->main_wake_lock);
+			continue;
+		}
+
+		if (due <= tm_now())
+			break;
+
+		/* More updates may come in meanwhile. */
+		ts.tv_sec = due / NSEC_PER_SEC;
+		ts.tv_nsec = due % NSEC_PER_SEC;
+		pthread_cond_timedwait(&tc->main_wake_cond,
+				       &tc->main_wake_lock, &ts);
 	}
+	pthread_mutex_unlock(&tc->main_wake_lock);
 }
 
 static int tm_tc_init(struct tm_context *tc)
 {
+	pthread_condattr_t attr;
 	size_t obj_off;
 	int i, err;
 
 	tc->should_stop = false;
+	tc->single_thread = false;
 	tc->draw_all = false;
 	tc->init_done = false;
-	INIT_LIST_HEAD(&tc->list_update);
 
 	err = pthread_mutex_init(&tc->init_lock, NULL);
 	if (err) {
@@ -173,7 +343,18 @@ static int tm_tc_init(struct tm_context *tc)
 		pr_err("pthread_mutex_init");
 		goto out;
 	}
-	err = pthread_cond_init(&tc->main_wake_cond, NULL);
+
+	/* Frame deadlines are in CLOCK_MONOTONIC. */
+	err = pthread_condattr_init(&attr);
+	if (err) {
+		errno = err;
+		pr_err("pthread_condattr_init");
+		goto out;
+	}
+	err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (!err)
+		err = pthread_cond_init(&tc->main_wake_cond, &attr);
+	pthread_condattr_destroy(&attr);
 	if (err) {
 		errno = err;
 		pr_err("pthread_cond_init");
@@ -291,6 +472,7 @@ static void tm_generate_object_origin(struct tm_context *tc)
 		 */
 		ta->origin[i].x = (int)x;
 		ta->origin[i].y = (int)y;
+		tm_item_set_origin(i, ta->origin[i].x, ta->origin[i].y);
 
 		o->get_area(tc, &area);
 	}
@@ -308,10 +490,12 @@ int main(int argc, char **argv)
 		goto out;
 
 	err = tm_init_all(tc, argc, argv, &exit_idx);
-	if (err)
-		tc->should_stop = true;
-	else
+	if (err) {
+		__atomic_store_n(&tc->should_stop, true, __ATOMIC_RELEASE);
+	} else {
 		tm_generate_object_origin(tc);
+		tm_x_glyph_prepare(tc);
+	}
 
 	/* Let other threads start working. */
 	pthread_mutex_lock(&tc->init_lock);
@@ -322,36 +506,21 @@ int main(int argc, char **argv)
 	if (err)
 		goto err;
 
-	/* All drawing operations are done on main thread. */
-	for (;;) {
-		LIST_HEAD(list_update);
-		bool draw_all;
+	/* Timers, X events and drawing, all on this thread. */
+	if (tc->single_thread) {
+		tm_thread_run(tc);
+		goto err;
+	}
 
-		pthread_mutex_lock(&tc->main_wake_lock);
-		while (!tc->should_stop && list_empty(&tc->list_update) &&
-		       !tc->draw_all)
-			pthread_cond_wait(&tc->main_wake_cond,
-					  &tc->main_wake_lock);
+	/* All drawing operations are done on main thread. */
+	tm_x_sched_apply(tc, true);
 
-		if (tc->should_stop) {
-			pthread_mutex_unlock(&tc->main_wake_lock);
+	for (;;) {
+		tm_frame_wait(tc);
+		if (tm_should_stop(tc))
 			break;
-		}
-
-		if (!list_empty(&tc->list_update))
-			list_replace_init(&tc->list_update, &list_update);
-
-		draw_all = tc->draw_all;
-		if (tc->draw_all)
-			tc->draw_all = false;
-		pthread_mutex_unlock(&tc->main_wake_lock);
 
-		if (draw_all)
-			tm_draw_all(tc);
-		else if (!list_empty(&list_update))
-			tm_draw_list(tc, &list_update);
-
-		tm_x_flush(tc);
+		tm_draw(tc);
 	}
 err:
 	tm_exit_all(tc, exit_idx - 1);
@@ -366,7 +535,18 @@ static void tm_main_help(struct tm_context *tc)
 	printf("usage: %s [options]\n", PACKAGE);
 
 	printf("\n\t--help\n"
-	       "\t\tShow this message and exit with 2.\n");
+	       "\t\tShow this message and exit with 2.\n"
+	       "\t--stats <SECONDS>\n"
+	       "\t\tPrint statistics to stderr every SECONDS.\n"
+	       "\t--single_thread\n"
+	       "\t\tHandle timers, X events and drawing in one thread.\n"
+	       "\t\tCollectors which may block still run on their own.\n"
+	       "\t--frame_window <MSECS>\n"
+	       "\t\tUpdates arriving within this are drawn in one frame.\n"
+	       "\t\tDefault is 10.\n"
+	       "\t--max_fps <FPS>\n"
+	       "\t\tUpper limit of frames per second. 0 is unlimited.\n"
+	       "\t\tDefault is 30.\n");
 }
 
 static void tm_main_help_all(struct tm_context *tc)
@@ -385,10 +565,35 @@ static void tm_main_help_all(struct tm_context *tc)
 	}
 }
 
+static int tm_main_stats_all(struct tm_context *tc)
+{
+	int i;
+
+	for (i = 0; i < TM_OBJECT_MAX; i++) {
+		struct tm_object *o;
+
+		o = tm_objs[i];
+
+		if (!o || !o->stats)
+			continue;
+
+		o->stats(tc);
+	}
+
+	return 0;
+}
+
+static struct tm_thread_timer timer_stats = {
+	.timer_cb	= tm_main_stats_all
+};
+
 static int tm_main_parse_opts(struct tm_context *tc, int argc, char **argv)
 {
+	struct tm_main *ta;
 	int i, err;
+	long val;
 
+	ta = tm_main(tc);
 	err = 0;
 
 	for (i = 0; i < argc; i++) {
@@ -396,6 +601,45 @@ static int tm_main_parse_opts(struct tm_context *tc, int argc, char **argv)
 			tm_main_help_all(tc);
 			err = 2;
 			break;
+		} else if (!strcmp(argv[i], "--stats")) {
+			if (++i >= argc) {
+				fprintf(stderr, "--stats needs argument.\n");
+				err = 1;
+				break;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], 0, INT_MAX,
+					 &val)) {
+				err = 1;
+				break;
+			}
+			ta->stats_secs = val;
+		} else if (!strcmp(argv[i], "--single_thread")) {
+			tc->single_thread = true;
+		} else if (!strcmp(argv[i], "--frame_window")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--frame_window needs argument.\n");
+				err = 1;
+				break;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], 0, INT_MAX,
+					 &val)) {
+				err = 1;
+				break;
+			}
+			ta->frame_window = val;
+		} else if (!strcmp(argv[i], "--max_fps")) {
+			if (++i >= argc) {
+				fprintf(stderr, "--max_fps needs argument.\n");
+				err = 1;
+				break;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], 0, INT_MAX,
+					 &val)) {
+				err = 1;
+				break;
+			}
+			ta->max_fps = val;
 		}
 	}
 
@@ -404,9 +648,15 @@ static int tm_main_parse_opts(struct tm_context *tc, int argc, char **argv)
 
 static int tm_main_init(struct tm_context *tc, int argc, char **argv)
 {
+	struct tm_main *ta;
 	sigset_t set;
 	int err;
 
+	ta = tm_main(tc);
+
+	ta->frame_window = 10;
+	ta->max_fps = 30;
+
 	err = tm_main_parse_opts(tc, argc, argv);
 	if (err)
 		goto out;
@@ -421,21 +671,56 @@ static int tm_main_init(struct tm_context *tc, int argc, char **argv)
 	}
 
 	err = pthread_sigmask(SIG_BLOCK, &set, NULL);
-	if (err)
+	if (err) {
 		pr_err("pthread_sigmask");
+		goto out;
+	}
+
+	/* Objects print their statistics periodically. */
+	if (ta->stats_secs > 0) {
+		timer_stats.expires_msecs = ta->stats_secs * 1000;
+		err = tm_thread_timer_add(&timer_stats);
+	}
 out:
 	return err;
 }
 
 static void tm_main_exit(struct tm_context *tc)
 {
+	tm_thread_timer_del(&timer_stats);
+}
+
+static void tm_main_stats(struct tm_context *tc)
+{
+	static u64 last_time, last_frames;
+	struct tm_main *ta;
+	u64 now, frames;
+
+	ta = tm_main(tc);
+	now = tm_now();
+	frames = ta->nr_frames;
+
+	if (last_time)
+		fprintf(stderr, "frame: %.2f fps, %.1f items/frame, "
+			"%llu frames\n",
+			(double)(frames - last_frames) * NSEC_PER_SEC /
+			(now - last_time),
+			frames ? (double)ta->nr_frame_items / frames : 0.0,
+			(unsigned long long)frames);
+
+	last_time = now;
+	last_frames = frames;
+
+	tm_x_stats(tc);
+	tm_layout_stats();
 }
 
 static struct tm_object tm_object_main = {
 	.obj_size	= sizeof(struct tm_main),
 	.help		= tm_main_help,
 	.init		= tm_main_init,
-	.exit		= tm_main_exit
+	.exit		= tm_main_exit,
+	.stats		= tm_main_stats
 };
 
 __attribute__((constructor))
@@ -12,7 +12,12 @@
 
 extern void __panic(const char *func, int line);
 extern void __pr_err(const char *func, int line, const char *s, int eno);
+extern int tm_parse_num(const char *opt, const char *s, long min, long max,
+			long *val);
 extern int tm_object_register(int id, struct tm_object *o);
 extern int tm_object_unregister(int id);
+extern bool tm_draw(struct tm_context *tc);
+extern int tm_frame_timeout(struct tm_context *tc);
+extern void tm_stop(struct tm_context *tc);
 
 #endif /* _TM_MAIN_H */
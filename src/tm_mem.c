@@ -1,6 +1,8 @@
 #include "tm_main.h"
 #include "tm_x.h"
 #include "tm_thread.h"
+#include "tm_metric.h"
+#include "tm_layout.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -15,6 +17,10 @@ struct tm_mem {
 
 	/* ram */
 	struct tm_item	item_ram[6];
+
+	/* source file */
+	struct tm_io_file	io_meminfo;
+	struct tm_io_file	*io_files[1];
 };
 
 static struct tm_mem *tm_mem(struct tm_context *tc)
@@ -50,55 +56,46 @@ out:
 }
 
 /**
- * "RAM":	item_ram[0]	fixed-width
- *
+ * "RAM"
  * "XXX MiB / YYY GiB"
- *
- * "XXX":	item_ram[1]	3-digit+dot, right-align
- * " MiB":	item_ram[2]	fixed-width(max-unit-width), left-align
- * " / ":	item_ram[3]	fixed-width
- * "YYY":	item_ram[4]	3-digit+dot, right-align
- * " GiB":	item_ram[5]	fixed-widht8max-unit-width), left-align
  */
+static const struct tm_layout_field layout_mem[] = {
+	TM_LAYOUT_LABEL("RAM"),
+	TM_LAYOUT_ROW,
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_MEM_USED,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_IB, TM_METRIC_MEM_USED),
+	TM_LAYOUT_LABEL(" / "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_MEM_TOTAL,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_IB, TM_METRIC_MEM_TOTAL)
+};
+
 static void tm_mem_item_mem_init(struct tm_context *tc)
 {
-	double x, y, avail, ut_wid, height, margin_icon;
 	struct tm_icon *icon_mem;
 	struct tm_mem *mem;
-	u32 mem_fg, mem_hi;
+	u32 colors[2];
+	double x, y;
 
 	mem = tm_mem(tc);
 	icon_mem = &mem->icon_mem;
 
-	mem_fg = mem->mem_fg;
-	mem_hi = mem->mem_hi;
-
-	avail = tm_x_font_dot_width(tc) + tm_x_font_max_digit_width(tc) * 3.0;
-	height = (double)tm_x_font_max_height(tc);
+	colors[TM_LAYOUT_FG] = mem->mem_fg;
+	colors[TM_LAYOUT_HI] = mem->mem_hi;
 
-	margin_icon = tm_x_margin_icon(tc);
-	x = icon_mem->width + margin_icon;
-	y = icon_mem->height / 2.0 - height;
+	x = icon_mem->width + tm_x_margin_icon(tc);
+	y = icon_mem->height / 2.0 - tm_x_font_max_height(tc);
 
-	tm_x_text_size(tc, " iB", 3, &ut_wid, NULL);
-	ut_wid += (double)tm_x_font_max_unit_width(tc);
-
-	tm_item_init(tc, &mem->item_ram[0], TM_OBJECT_MEM, mem_fg, &x, &y,
-		     0, height, "RAM", TM_ITEM_WIDTH_FIXED);
+	tm_layout_apply(tc, TM_OBJECT_MEM, layout_mem, ARRAY_SIZE(layout_mem),
+			colors, NULL, mem->item_ram, &x, &y);
+}
 
-	x = icon_mem->width + margin_icon;
-	y += height;
+static const char *tm_mem_next_line(const char *p)
+{
+	p = strchr(p, '\n');
 
-	tm_item_init(tc, &mem->item_ram[1], TM_OBJECT_MEM, mem_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &mem->item_ram[2], TM_OBJECT_MEM, mem_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
-	tm_item_init(tc, &mem->item_ram[3], TM_OBJECT_MEM, mem_fg, &x, &y,
-		     0, height, " / ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &mem->item_ram[4], TM_OBJECT_MEM, mem_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &mem->item_ram[5], TM_OBJECT_MEM, mem_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
+	return p && p[1] ? p + 1 : NULL;
 }
 
 /* Read /proc/meminfo periodically. */
@@ -120,22 +117,22 @@ static int tm_mem_timer_cb(struct tm_context *tc)
 	};
 	struct tm_mem *mem;
 	int err, nr_hits;
-	char buf[80];
-	FILE *fp;
+	const char *buf;
 
 	err = 1;
 	mem = tm_mem(tc);
 
-	fp = fopen("/proc/meminfo", "r");
-	if (!fp) {
-		pr_err("fopen");
+	/* Read by event thread already. */
+	if (mem->io_meminfo.len <= 0) {
+		fprintf(stderr, "Can't read from /proc/meminfo.\n");
 		goto out;
 	}
 
 	mem_total = mem_free = buffers = cached = sreclaimable = 0UL;
 
 	nr_hits = 0;
-	while (nr_hits < ARRAY_SIZE(minfo) && fgets(buf, sizeof(buf), fp)) {
+	for (buf = mem->io_meminfo.buf; nr_hits < ARRAY_SIZE(minfo) && buf;
+	     buf = tm_mem_next_line(buf)) {
 		int i;
 
 		for (i = 0; i < ARRAY_SIZE(minfo); i++) {
@@ -159,8 +156,6 @@ static int tm_mem_timer_cb(struct tm_context *tc)
 		}
 	}
 
-	fclose(fp);
-
 	if (nr_hits != ARRAY_SIZE(minfo))
 		fprintf(stderr, "Couldn't get all meminfo.\n");
 
@@ -169,10 +164,8 @@ static int tm_mem_timer_cb(struct tm_context *tc)
 	used *= 1024;
 	mem_total *= 1024;
 
-	tm_item_data_unit_update(&mem->item_ram[1], &mem->item_ram[2],
-				 (double)used);
-	tm_item_data_unit_update(&mem->item_ram[4], &mem->item_ram[5],
-				 (double)mem_total);
+	tm_metric_set_u64(TM_METRIC_MEM_USED, used);
+	tm_metric_set_u64(TM_METRIC_MEM_TOTAL, mem_total);
 
 	err = 0;
 out:
@@ -181,7 +174,8 @@ out:
 
 static struct tm_thread_timer timer_mem = {
 	.timer_cb	= tm_mem_timer_cb,
-	.expires_msecs	= 3000
+	.expires_msecs	= 3000,
+	.max_msecs	= 24000
 };
 
 static int tm_mem_init(struct tm_context *tc, int argc, char **argv)
@@ -207,17 +201,32 @@ static int tm_mem_init(struct tm_context *tc, int argc, char **argv)
 	err = tm_x_load_icon(tc, "icon3.svg", TM_ICON_SIDE | TM_ICON_FLIP,
 			     &mem->icon3);
 	if (err)
-		goto err;
+		goto err1;
 
 	tm_mem_item_mem_init(tc);
 
+	err = tm_io_file_open(&mem->io_meminfo, "/proc/meminfo");
+	if (err)
+		goto err2;
+
+	mem->io_files[0] = &mem->io_meminfo;
+	timer_mem.io_files = mem->io_files;
+	timer_mem.nr_io_files = ARRAY_SIZE(mem->io_files);
+
 	/* Gather memory information. */
-	tm_thread_timer_add(&timer_mem);
+	err = tm_thread_timer_add(&timer_mem);
+	if (err)
+		goto err3;
 
-	err = tm_mem_timer_cb(tc);
+	err = tm_io_pread(mem->io_files, ARRAY_SIZE(mem->io_files)) ||
+	      tm_mem_timer_cb(tc);
 out:
 	return err;
-err:
+err3:
+	tm_io_file_close(&mem->io_meminfo);
+err2:
+	tm_x_unload_icon(&mem->icon3);
+err1:
 	tm_x_unload_icon(&mem->icon_mem);
 	goto out;
 }
@@ -230,6 +239,7 @@ static void tm_mem_exit(struct tm_context *tc)
 
 	/* Uninstall timer handler. */
 	tm_thread_timer_del(&timer_mem);
+	tm_io_file_close(&mem->io_meminfo);
 
 	/* Unload mem icon. */
 	tm_x_unload_icon(&mem->icon3);
@@ -269,9 +279,6 @@ static void tm_mem_draw(struct tm_context *tc)
 	tm_x_draw_icon(tc, &mem->icon3,
 		       (int)(area.width - mem->icon3.width),
 		       (int)(area.height - mem->icon3.height));
-
-	/* ram */
-	tm_x_draw_text(tc, mem->item_ram, ARRAY_SIZE(mem->item_ram));
 }
 
 static struct tm_object tm_object_mem = {
@@ -0,0 +1,302 @@
+#include "tm_metric.h"
+#include "tm_fmt.h"
+#include <stdio.h>
+
+#define TM_METRIC_ITEMS_MAX	3
+
+/**
+ * @seq: Odd while being written. Readers retry until they see an even and
+ * unchanged one.
+ * @counter: COUNTER, and the last raw count of RATE.
+ * @value: GAUGE, and per second of RATE.
+ * @quantum: What the last published sample looks like on screen. Only the
+ * writer touches this.
+ */
+struct tm_metric {
+	u8			type;
+	u8			unit;
+	u32			seq;
+	u64			counter;
+	double			value;
+	u64			sampled_ns;
+	u64			quantum;
+
+	int			nr_items;
+	u16			items[TM_METRIC_ITEMS_MAX];
+};
+
+#define TM_METRIC(__type, __unit)	\
+	{ .type = TM_METRIC_##__type, .unit = TM_METRIC_UNIT_##__unit }
+
+static struct tm_metric metrics[TM_METRIC_MAX] = {
+	[TM_METRIC_UPTIME]	= TM_METRIC(COUNTER, UPTIME),
+	[TM_METRIC_LOADAVG1]	= TM_METRIC(GAUGE, LOAD),
+	[TM_METRIC_LOADAVG5]	= TM_METRIC(GAUGE, LOAD),
+	[TM_METRIC_LOADAVG15]	= TM_METRIC(GAUGE, LOAD),
+	[TM_METRIC_CPU_US]	= TM_METRIC(GAUGE, PERCENT),
+	[TM_METRIC_CPU_SY]	= TM_METRIC(GAUGE, PERCENT),
+	[TM_METRIC_CPU_ID]	= TM_METRIC(GAUGE, PERCENT),
+	[TM_METRIC_CPU_TEMP1]	= TM_METRIC(GAUGE, CELSIUS),
+	[TM_METRIC_CPU_TEMP2]	= TM_METRIC(GAUGE, CELSIUS),
+	[TM_METRIC_MEM_USED]	= TM_METRIC(COUNTER, BYTES),
+	[TM_METRIC_MEM_TOTAL]	= TM_METRIC(COUNTER, BYTES),
+	[TM_METRIC_DISK_USED]	= TM_METRIC(COUNTER, BYTES),
+	[TM_METRIC_DISK_TOTAL]	= TM_METRIC(COUNTER, BYTES),
+	[TM_METRIC_NET_TX_RATE]	= TM_METRIC(RATE, BITS),
+	[TM_METRIC_NET_TX]	= TM_METRIC(COUNTER, BYTES_SI),
+	[TM_METRIC_NET_RX_RATE]	= TM_METRIC(RATE, BITS),
+	[TM_METRIC_NET_RX]	= TM_METRIC(COUNTER, BYTES_SI)
+};
+
+/**
+ * How finely each unit is displayed, which is also how finely samples are
+ * compared. A sample is first turned into a fixed-point number:
+ *
+ * @scale: Multiplier to the sample.
+ * @div: Divisor to the above, for units coarser than the sample.
+ * @frac, @width: Decimal digits of the fixed-point number, and maximum
+ * characters to print, as tm_fmt_fixed().
+ * @base: 1000 or 1024 to scale it with a prefix, or 0. Scaled ones are
+ * always printed in 3 significant digits.
+ */
+static const struct tm_metric_desc {
+	u32			scale;
+	u32			div;
+	u8			frac;
+	u8			width;
+	u16			base;
+	bool			iec;
+	const char		*suffix;
+} descs[] = {
+	[TM_METRIC_UNIT_UPTIME]		= { 1, 60, 0, 0, 0 },
+	[TM_METRIC_UNIT_PERCENT]	= { 10, 1, 1, 4, 0 },
+	[TM_METRIC_UNIT_LOAD]		= { 100, 1, 2, 4, 0 },
+	[TM_METRIC_UNIT_CELSIUS]	= { 1, 1, 0, 0, 0 },
+	[TM_METRIC_UNIT_BYTES]		= { 1, 1, 0, 0, 1024, true, "B" },
+	[TM_METRIC_UNIT_BYTES_SI]	= { 1, 1, 0, 0, 1000, false, "B" },
+	[TM_METRIC_UNIT_BITS]		= { 8, 1, 0, 0, 1000, false, "bps" }
+};
+
+static void tm_metric_write_begin(struct tm_metric *m)
+{
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void tm_metric_write_end(struct tm_metric *m)
+{
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+}
+
+static u64 tm_metric_fixed(const struct tm_metric *m)
+{
+	const struct tm_metric_desc *d;
+	u64 val;
+
+	d = &descs[m->unit];
+
+	if (m->type == TM_METRIC_COUNTER)
+		val = m->counter * d->scale;
+	else if (m->value <= 0)
+		val = 0;
+	else
+		val = (u64)(m->value * d->scale + 0.5);
+
+	return val / d->div;
+}
+
+/* Two samples with the same quantum print the same strings. */
+static u64 tm_metric_quantum(const struct tm_metric *m)
+{
+	const struct tm_metric_desc *d;
+	int prefix, keep;
+	u64 val;
+
+	d = &descs[m->unit];
+	val = tm_metric_fixed(m);
+
+	if (d->base) {
+		val = tm_fmt_scale(val, d->base, &prefix);
+		val = tm_fmt_fixed_quantum(val, 2, 4, &keep);
+		return val << 8 | keep << 4 | prefix;
+	}
+
+	val = tm_fmt_fixed_quantum(val, d->frac, d->width, &keep);
+
+	return val << 4 | keep;
+}
+
+/* Let items showing @m be drawn again. */
+static void tm_metric_publish(struct tm_metric *m)
+{
+	int i;
+
+	for (i = 0; i < m->nr_items; i++)
+		tm_item_update_add(m->items[i]);
+}
+
+/* Publish @m only when it would look different. */
+static void tm_metric_update(struct tm_metric *m, bool first)
+{
+	u64 quantum;
+
+	quantum = tm_metric_quantum(m);
+	if (!first && quantum == m->quantum)
+		return;
+
+	m->quantum = quantum;
+	tm_metric_publish(m);
+}
+
+void tm_metric_set_u64(int id, u64 val)
+{
+	struct tm_metric *m;
+	double value;
+	bool first;
+	u64 now;
+
+	m = &metrics[id];
+	now = tm_now();
+	first = !m->sampled_ns;
+	value = m->value;
+
+	/* Nothing to compare with on the first sample, and the counter may
+	 * go back when the interface is reset.
+	 */
+	if (m->type == TM_METRIC_RATE) {
+		value = 0;
+		if (!first && now > m->sampled_ns && val >= m->counter)
+			value = (double)(val - m->counter) * 1000000000.0 /
+				(now - m->sampled_ns);
+	}
+
+	tm_metric_write_begin(m);
+	m->counter = val;
+	m->value = value;
+	m->sampled_ns = now;
+	tm_metric_write_end(m);
+
+	tm_metric_update(m, first);
+}
+
+void tm_metric_set_double(int id, double val)
+{
+	struct tm_metric *m;
+	bool first;
+
+	m = &metrics[id];
+	first = !m->sampled_ns;
+
+	tm_metric_write_begin(m);
+	m->value = val;
+	m->sampled_ns = tm_now();
+	tm_metric_write_end(m);
+
+	tm_metric_update(m, first);
+}
+
+/* Consistent copy of @id. */
+static void tm_metric_read(int id, struct tm_metric *copy)
+{
+	struct tm_metric *m;
+	u32 seq;
+
+	m = &metrics[id];
+
+	do {
+		seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		copy->type = m->type;
+		copy->unit = m->unit;
+		copy->counter = m->counter;
+		copy->value = m->value;
+		copy->sampled_ns = m->sampled_ns;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 seq != __atomic_load_n(&m->seq, __ATOMIC_RELAXED));
+}
+
+u64 tm_metric_get_u64(int id, u64 *sampled_ns)
+{
+	struct tm_metric m;
+
+	tm_metric_read(id, &m);
+	if (sampled_ns)
+		*sampled_ns = m.sampled_ns;
+
+	return m.type == TM_METRIC_COUNTER ? m.counter : (u64)m.value;
+}
+
+double tm_metric_get_double(int id, u64 *sampled_ns)
+{
+	struct tm_metric m;
+
+	tm_metric_read(id, &m);
+	if (sampled_ns)
+		*sampled_ns = m.sampled_ns;
+
+	return m.type == TM_METRIC_COUNTER ? (double)m.counter : m.value;
+}
+
+void tm_metric_bind(int id, struct tm_item *item, int part)
+{
+	struct tm_metric *m;
+
+	m = &metrics[id];
+
+	if (m->nr_items >= TM_METRIC_ITEMS_MAX) {
+		fprintf(stderr, "%s: too many items for metric %d.\n",
+			__func__, id);
+		return;
+	}
+
+	m->items[m->nr_items++] = item->idx;
+	tm_items.metric[item->idx] = id;
+	tm_items.metric_part[item->idx] = part;
+}
+
+/* Turn the latest sample into the text of item @idx. */
+void tm_metric_format(int idx)
+{
+	const struct tm_metric_desc *d;
+	char buf[ITEM_STR_MAX];
+	struct tm_metric m;
+	int len, prefix;
+	u64 val;
+
+	if (tm_items.metric[idx] == TM_METRIC_NONE)
+		return;
+
+	tm_metric_read(tm_items.metric[idx], &m);
+	if (!m.sampled_ns)
+		return;
+
+	d = &descs[m.unit];
+	val = tm_metric_fixed(&m);
+
+	switch (tm_items.metric_part[idx]) {
+	case TM_METRIC_PART_DAYS:
+		len = tm_fmt_fixed(buf, val / (24 * 60), 0, 0);
+		break;
+	case TM_METRIC_PART_HOURS:
+		len = tm_fmt_fixed(buf, val / 60 % 24, 0, 0);
+		break;
+	case TM_METRIC_PART_MINUTES:
+		len = tm_fmt_fixed(buf, val % 60, 0, 0);
+		break;
+	case TM_METRIC_PART_UNIT:
+		tm_fmt_scale(val, d->base, &prefix);
+		len = tm_fmt_unit(buf, prefix, d->iec, d->suffix);
+		break;
+	default:
+		if (d->base)
+			len = tm_fmt_scaled(buf, val, d->base, &prefix);
+		else
+			len = tm_fmt_fixed(buf, val, d->frac, d->width);
+		break;
+	}
+
+	tm_item_set_str(idx, buf, len);
+}
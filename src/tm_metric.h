@@ -0,0 +1,86 @@
+#ifndef _TM_METRIC_H
+#define _TM_METRIC_H
+
+#include "tm.h"
+#include "tm_item.h"
+
+/**
+ * Collectors store numbers here, not strings. Items bound to a metric are
+ * formatted on main thread only when they are about to be drawn, and the
+ * numbers stay available to anyone through tm_metric_get_*().
+ *
+ * @TM_METRIC_COUNTER: u64 as is, e.g. bytes in use.
+ * @TM_METRIC_GAUGE: double as is, e.g. percentage.
+ * @TM_METRIC_RATE: Fed with a cumulative u64 counter. The value is its
+ * increase per second between the last two samples.
+ */
+enum {
+	TM_METRIC_COUNTER,
+	TM_METRIC_GAUGE,
+	TM_METRIC_RATE
+};
+
+/**
+ * How a metric is displayed.
+ *
+ * @TM_METRIC_UNIT_UPTIME: Seconds, shown as days, hours and minutes.
+ * @TM_METRIC_UNIT_PERCENT: One decimal digit, "12.3".
+ * @TM_METRIC_UNIT_LOAD: 3 significant digits, "1.23".
+ * @TM_METRIC_UNIT_CELSIUS: Integer.
+ * @TM_METRIC_UNIT_BYTES: IEC prefixed, "1.23" " MiB".
+ * @TM_METRIC_UNIT_BYTES_SI: SI prefixed, "1.23" " MB".
+ * @TM_METRIC_UNIT_BITS: Bytes shown as SI prefixed bits, "1.23" " Mbps".
+ */
+enum {
+	TM_METRIC_UNIT_UPTIME,
+	TM_METRIC_UNIT_PERCENT,
+	TM_METRIC_UNIT_LOAD,
+	TM_METRIC_UNIT_CELSIUS,
+	TM_METRIC_UNIT_BYTES,
+	TM_METRIC_UNIT_BYTES_SI,
+	TM_METRIC_UNIT_BITS
+};
+
+/* Which part of a metric an item shows. */
+enum {
+	TM_METRIC_PART_VALUE,
+	TM_METRIC_PART_UNIT,
+	TM_METRIC_PART_DAYS,
+	TM_METRIC_PART_HOURS,
+	TM_METRIC_PART_MINUTES
+};
+
+/* TM_METRIC_NONE is 0, so that items are unbound by default. */
+enum {
+	TM_METRIC_NONE,
+	TM_METRIC_UPTIME,
+	TM_METRIC_LOADAVG1,
+	TM_METRIC_LOADAVG5,
+	TM_METRIC_LOADAVG15,
+	TM_METRIC_CPU_US,
+	TM_METRIC_CPU_SY,
+	TM_METRIC_CPU_ID,
+	TM_METRIC_CPU_TEMP1,
+	TM_METRIC_CPU_TEMP2,
+	TM_METRIC_MEM_USED,
+	TM_METRIC_MEM_TOTAL,
+	TM_METRIC_DISK_USED,
+	TM_METRIC_DISK_TOTAL,
+	TM_METRIC_NET_TX_RATE,
+	TM_METRIC_NET_TX,
+	TM_METRIC_NET_RX_RATE,
+	TM_METRIC_NET_RX,
+	TM_METRIC_MAX
+};
+
+/* Each metric must be written by one timer only. */
+extern void tm_metric_set_u64(int id, u64 val);
+extern void tm_metric_set_double(int id, double val);
+extern u64 tm_metric_get_u64(int id, u64 *sampled_ns);
+extern double tm_metric_get_double(int id, u64 *sampled_ns);
+/* Call before the first sample. */
+extern void tm_metric_bind(int id, struct tm_item *item, int part);
+/* Only main thread may call this. */
+extern void tm_metric_format(int idx);
+
+#endif /* _TM_METRIC_H */
@@ -1,6 +1,8 @@
 #include "tm_main.h"
 #include "tm_x.h"
 #include "tm_thread.h"
+#include "tm_metric.h"
+#include "tm_layout.h"
 #include <sys/types.h>
 #include <asm/types.h>
 #include <sys/socket.h>
@@ -13,6 +15,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 struct tm_net_stat {
 	u64		rx_packets;
@@ -32,7 +35,6 @@ struct tm_net {
 	unsigned int	ifi_flags;
 	size_t		dn_len;
 	char		dot_notion[64];
-	struct tm_net_stat	st_dif;
 	struct tm_net_stat	st_cur;
 
 	/* icon */
@@ -54,6 +56,7 @@ static struct tm_net *tm_net(struct tm_context *tc)
 static int tm_net_parse_opts(struct tm_net *net, int argc, char **argv)
 {
 	int i, err;
+	long val;
 
 	err = 1;
 
@@ -70,8 +73,10 @@ static int tm_net_parse_opts(struct tm_net *net, int argc, char **argv)
 					"--net_interval needs argument.\n");
 				goto out;
 			}
-			/* Hope user is careful enough. */
-			net->interval = atoi(argv[i]);
+			if (tm_parse_num(argv[i - 1], argv[i], 1, INT_MAX,
+					 &val))
+				goto out;
+			net->interval = val;
 		} else if (!strcmp(argv[i], "--net_fg")) {
 			if (++i >= argc) {
 				fprintf(stderr, "--net_fg needs argument.\n");
@@ -120,117 +125,69 @@ out:
 }
 
 /**
- * "wlan0: up"
- * "wlan0: ":		item_if_state[0]	fixed-width
- * "up(/down)":		item_if_state[1]	changeable, left-align
- *
- * "XX.XX.XX.XX/YY":	item_if_state[2]	changeable, left-align
+ * "wlan0: up". The interface is an arg.
+ * "XX.XX.XX.XX/YY"
  */
-static void tm_net_item_if_state_init(struct tm_context *tc)
+static const struct tm_layout_field layout_if_state[] = {
+	TM_LAYOUT_ARG_LABEL,
+	TM_LAYOUT_STR(TM_LAYOUT_HI),
+	TM_LAYOUT_ROW,
+	TM_LAYOUT_STR(TM_LAYOUT_FG)
+};
+
+/**
+ * "  Up: X.XX Ybps / XX.X YB"
+ * "Down: X.XX Ybps / XX.X YB"
+ */
+static const struct tm_layout_field layout_if_stat[] = {
+	TM_LAYOUT_FIT_LABEL("Up: ", "Down: "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_NET_TX_RATE,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_BPS, TM_METRIC_NET_TX_RATE),
+	TM_LAYOUT_LABEL(" / "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_NET_TX,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_BPS, TM_METRIC_NET_TX),
+	TM_LAYOUT_ROW,
+	TM_LAYOUT_FIT_LABEL("Down: ", "Down: "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_NET_RX_RATE,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_BPS, TM_METRIC_NET_RX_RATE),
+	TM_LAYOUT_LABEL(" / "),
+	TM_LAYOUT_VALUE(TM_LAYOUT_NUMBER, TM_METRIC_NET_RX,
+			TM_METRIC_PART_VALUE),
+	TM_LAYOUT_UNIT(TM_LAYOUT_UNIT_BPS, TM_METRIC_NET_RX)
+};
+
+static void tm_net_items_init(struct tm_context *tc)
 {
-	double x, y, height, margin_icon;
 	struct tm_icon *icon_net;
+	const char *args[1];
 	struct tm_net *net;
-	u32 net_fg, net_hi;
 	char if_str[32];
+	u32 colors[2];
+	double x, y;
 
 	net = tm_net(tc);
 	icon_net = &net->icon_net;
 
-	net_fg = net->net_fg;
-	net_hi = net->net_hi;
-
-	margin_icon = tm_x_margin_icon(tc);
-	height = (double)tm_x_font_max_height(tc);
-
-	x = icon_net->width + margin_icon;
-	y = icon_net->height / 2.0 - height;
+	colors[TM_LAYOUT_FG] = net->net_fg;
+	colors[TM_LAYOUT_HI] = net->net_hi;
 
 	sprintf(if_str, "%s: ", net->if_name);
+	args[0] = if_str;
 
-	tm_item_init(tc, &net->item_if_state[0], TM_OBJECT_NET, net_fg, &x, &y,
-		     0, height, if_str, TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &net->item_if_state[1], TM_OBJECT_NET, net_hi, &x, &y,
-		     0, height, NULL,
-		     TM_ITEM_WIDTH_CHANGEABLE | TM_ITEM_ALIGN_LEFT);
-
-	x = icon_net->width + margin_icon;
-	y = icon_net->height / 2.0;
-
-	tm_item_init(tc, &net->item_if_state[2], TM_OBJECT_NET, net_fg, &x, &y,
-		     0, height, NULL,
-		     TM_ITEM_WIDTH_CHANGEABLE | TM_ITEM_ALIGN_LEFT);
-}
-
-/**
- * "Up: X.XX Ybps / XX.X YB"
- *
- * "Up: ":	item_if_stat[0]		fixed-width
- * "X.XX":	item_if_stat[1]		3digit+dot, right-align
- * " Ybps":	item_if_stat[2]		fixed-width(max-unit-width), left-align
- * " / ":	item_if_stat[3]		fixed-width
- * "XX.X":	item_if_stat[4]		3digit+dot, right-align
- * " YB":	item_if_stat[5]		fixed-width(max-unit-width), left-align
- *
- * "Down: X.XXX Ybps / XX.XX YB"
- *
- * "Down: ":	item_if_stat[6]		fixed-width
- * "X.XX":	item_if_stat[7]		3digit+dot, right-align
- * " Ybps":	item_if_stat[8]		fixed-width(max-unit-width), left-align
- * " / ":	item_if_stat[9]		fixed-width
- * "XX.X":	item_if_stat[10]	3digit+dot, right-align
- * " YB":	item_if_stat[11]	fixed-width(max-unit-width), left-align
- */
-static void tm_net_item_if_stat_init(struct tm_context *tc)
-{
-	double x, y, lbl_wid, avail, ut_wid, height;
-	struct tm_net *net;
-	u32 net_fg, net_hi;
-
-	net = tm_net(tc);
-
-	net_fg = net->net_fg;
-	net_hi = net->net_hi;
-
-	tm_x_text_size(tc, "Down: ", 6, &lbl_wid, NULL);
-
-	tm_x_text_size(tc, " bps", 4, &ut_wid, NULL);
-	ut_wid += (double)tm_x_font_max_unit_width(tc);
-
-	avail = tm_x_font_dot_width(tc) + tm_x_font_max_digit_width(tc) * 3.0;
-	height = (double)tm_x_font_max_height(tc);
-
-	x = 0;
-	y = net->icon_net.height + tm_x_margin_icon(tc);
-
-	tm_item_init(tc, &net->item_if_stat[0], TM_OBJECT_NET, net_fg, &x, &y,
-		     lbl_wid, height, "Up: ", TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &net->item_if_stat[1], TM_OBJECT_NET, net_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &net->item_if_stat[2], TM_OBJECT_NET, net_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
-	tm_item_init(tc, &net->item_if_stat[3], TM_OBJECT_NET, net_fg, &x, &y,
-		     0, height, " / ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &net->item_if_stat[4], TM_OBJECT_NET, net_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &net->item_if_stat[5], TM_OBJECT_NET, net_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
+	x = icon_net->width + tm_x_margin_icon(tc);
+	y = icon_net->height / 2.0 - tm_x_font_max_height(tc);
+	tm_layout_apply(tc, TM_OBJECT_NET, layout_if_state,
+			ARRAY_SIZE(layout_if_state), colors, args,
+			net->item_if_state, &x, &y);
 
 	x = 0;
-	y += height;
-
-	tm_item_init(tc, &net->item_if_stat[6], TM_OBJECT_NET, net_fg, &x, &y,
-		     lbl_wid, height, "Down: ", TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &net->item_if_stat[7], TM_OBJECT_NET, net_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &net->item_if_stat[8], TM_OBJECT_NET, net_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
-	tm_item_init(tc, &net->item_if_stat[9], TM_OBJECT_NET, net_fg, &x, &y,
-		     0, height, " / ", TM_ITEM_WIDTH_FIXED);
-	tm_item_init(tc, &net->item_if_stat[10], TM_OBJECT_NET, net_hi, &x, &y,
-		     avail, height, NULL, TM_ITEM_ALIGN_RIGHT);
-	tm_item_init(tc, &net->item_if_stat[11], TM_OBJECT_NET, net_fg, &x, &y,
-		     ut_wid, height, NULL, TM_ITEM_ALIGN_LEFT);
+	y = icon_net->height + tm_x_margin_icon(tc);
+	tm_layout_apply(tc, TM_OBJECT_NET, layout_if_stat,
+			ARRAY_SIZE(layout_if_stat), colors, NULL,
+			net->item_if_stat, &x, &y);
 }
 
 static void tm_net_sockaddr_nl_init(struct sockaddr_nl *addr)
@@ -541,11 +498,7 @@ static bool tm_net_recv_rtm_newlink(struct tm_context *tc, struct nlmsghdr *nlh)
 
 		sp = nla_data(nla);
 
-#define STORE_STAT(__mem)						\
-	do {								\
-		net->st_dif.__mem = sp->__mem - net->st_cur.__mem;	\
-		net->st_cur.__mem = sp->__mem;				\
-	} while (0)
+#define STORE_STAT(__mem)	(net->st_cur.__mem = sp->__mem)
 		STORE_STAT(rx_packets);
 		STORE_STAT(tx_packets);
 		STORE_STAT(rx_bytes);
@@ -575,15 +528,10 @@ static int tm_net_get_link(struct tm_context *tc)
 {
 	char buf[TM_NET_IOV_LEN];
 	struct sockaddr_nl addr;
-	struct tm_net *net;
 	struct msghdr msg;
 	struct iovec iov;
 	int nlsk;
 
-	net = tm_net(tc);
-
-	memset(&net->st_dif, 0, sizeof(net->st_dif));
-
 	return tm_net_send_nl_request(&nlsk, &msg, &addr, &iov, buf,
 				      RTM_GETLINK) ||
 	       tm_net_recv_nl_response(tc, nlsk, &msg, RTM_NEWLINK,
@@ -611,53 +559,19 @@ static void tm_net_ip_state_update(struct tm_context *tc)
 			       net->dn_len);
 }
 
-static void
-tm_net_stat_update(struct tm_item *item_stat, struct tm_item *item_unit,
-		   const char *fmt_unit, double data)
-{
-	const char *units, *p;
-	char str[16];
-	size_t len;
-
-	units = p = " kMGTPE";
-
-	while (data >= 1000) {
-		data /= 1000.0;
-		p++;
-	}
-
-	sprintf(str, "%.2f", data);
-	if (str[3] == '.') {
-		str[3] = '\0';
-		len = 3;
-	} else {
-		str[4] = '\0';
-		len = 4;
-	}
-	tm_item_cmp_and_update(item_stat, str, len);
-
-	if (p == units)
-		fmt_unit++;
-	len = sprintf(str, fmt_unit, *p);
-	tm_item_cmp_and_update(item_unit, str, len);
-}
-
+/* Rates are worked out by the metric store from when each sample is taken,
+ * so the period may be changed at runtime.
+ */
 static void tm_net_ip_stat_update(struct tm_context *tc)
 {
 	struct tm_net *net;
 
 	net = tm_net(tc);
 
-	tm_net_stat_update(&net->item_if_stat[1], &net->item_if_stat[2],
-			   " %cbps", (double)net->st_dif.tx_bytes * 8.0 /
-				     ((double)net->interval / 1000.0));
-	tm_net_stat_update(&net->item_if_stat[4], &net->item_if_stat[5],
-			   " %cB", (double)net->st_cur.tx_bytes);
-	tm_net_stat_update(&net->item_if_stat[7], &net->item_if_stat[8],
-			   " %cbps", (double)net->st_dif.rx_bytes * 8.0 /
-				     ((double)net->interval / 1000.0));
-	tm_net_stat_update(&net->item_if_stat[10], &net->item_if_stat[11],
-			   " %cB", (double)net->st_cur.rx_bytes);
+	tm_metric_set_u64(TM_METRIC_NET_TX_RATE, net->st_cur.tx_bytes);
+	tm_metric_set_u64(TM_METRIC_NET_TX, net->st_cur.tx_bytes);
+	tm_metric_set_u64(TM_METRIC_NET_RX_RATE, net->st_cur.rx_bytes);
+	tm_metric_set_u64(TM_METRIC_NET_RX, net->st_cur.rx_bytes);
 }
 
 static int tm_net_timer(struct tm_context *tc)
@@ -676,7 +590,9 @@ out:
 
 static struct tm_thread_timer timer_net = {
 	.timer_cb	= tm_net_timer,
-	.expires_msecs	= 1000
+	.expires_msecs	= 1000,
+	/* Two netlink dumps. The most expensive one. */
+	.prio		= TM_THREAD_PRIO_LOW
 };
 
 static int tm_net_init(struct tm_context *tc, int argc, char **argv)
@@ -708,19 +624,23 @@ static int tm_net_init(struct tm_context *tc, int argc, char **argv)
 	err = tm_x_load_icon(tc, "icon5.svg", TM_ICON_SIDE | TM_ICON_FLIP,
 			     &net->icon5);
 	if (err)
-		goto err;
+		goto err1;
 
-	tm_net_item_if_state_init(tc);
-	tm_net_item_if_stat_init(tc);
+	tm_net_items_init(tc);
 
 	/* Get i/f state and stats periodically. */
 	timer_net.expires_msecs = net->interval;
-	tm_thread_timer_add(&timer_net);
+	timer_net.max_msecs = net->interval * 8;
+	err = tm_thread_timer_add(&timer_net);
+	if (err)
+		goto err2;
 
 	err = tm_net_timer(tc);
 out:
 	return err;
-err:
+err2:
+	tm_x_unload_icon(&net->icon5);
+err1:
 	tm_x_unload_icon(&net->icon_net);
 	goto out;
 }
@@ -778,12 +698,6 @@ static void tm_net_draw(struct tm_context *tc)
 	tm_x_draw_icon(tc, &net->icon5,
 		       (int)(area.width - net->icon5.width),
 		       (int)(area.height - net->icon5.height));
-
-	/* i/f state */
-	tm_x_draw_text(tc, net->item_if_state, ARRAY_SIZE(net->item_if_state));
-
-	/* i/f stat */
-	tm_x_draw_text(tc, net->item_if_stat, ARRAY_SIZE(net->item_if_stat));
 }
 
 static struct tm_object tm_object_net = {
@@ -1,207 +1,1536 @@
+#define _GNU_SOURCE	/* pthread_setaffinity_np */
 #include "tm_thread.h"
 #include "tm_main.h"
 #include "tm_x.h"
-#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <limits.h>
+
+#define TM_THREAD_WORKER_MAX	8
 
 struct tm_thread {
-	pthread_t	tid_ev_mnger;
+	pthread_t		tid_ev_mnger;
+	pthread_t		tid_workers[TM_THREAD_WORKER_MAX];
+	int			nr_workers_running;
+	int			epfd;
+	struct tm_thread_fd	timerfd;	/* armed for nearest wakeup. */
+	struct tm_thread_fd	wakefd;		/* eventfd to wake us up. */
+	struct tm_thread_fd	sigfd;
+};
+
+static struct tm_thread *tm_thread(struct tm_context *tc)
+{
+	return tm_get_object(tc, TM_OBJECT_THREAD);
+}
+
+/* Timers are kept in a binary min-heap ordered by their absolute wakeup time,
+ * so the nearest one is always timer_heap[0].
+ */
+#define TM_THREAD_TIMER_MAX	16
+static struct tm_thread_timer *timer_heap[TM_THREAD_TIMER_MAX];
+static int nr_timers;
+
+/* Requests from other threads are pushed onto a lock-free stack, and applied
+ * by event loop. So dispatch path never waits for a lock.
+ */
+static struct tm_thread_timer *timer_pending;
+static int nr_timers_want;	/* timers requested to be armed. */
+static int ev_wakefd = -1;
+
+/* Requested by X when we become invisible, and followed by event loop. */
+static bool suspend_req;
+static bool suspended;
+
+/* Executors of TM_THREAD_TIMER_ISOLATED timers. Only event loop touches the
+ * array. Each one has a thread, and the rest is under its lock.
+ */
+struct tm_thread_exec {
+	pthread_t		tid;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct tm_thread_timer	*timer;
+	struct tm_context	*tc;
+	bool			kick;
+	bool			busy;
+	bool			stale;
+	bool			failed;	/* Last timer_cb failed. */
+	bool			exit;
+	u64			started;
+};
+
+#define TM_THREAD_IO_MAX	32
+
+static struct tm_thread_exec *execs[TM_THREAD_TIMER_MAX];
+static int nr_execs;
+
+/* Collector threads, i.e. event loop, workers and executors. */
+static struct tm_thread_sched collector_sched;
+
+/* Read source files via io_uring, if built with it. */
+static bool use_uring = true;
+static u64 exec_skips;
+static u64 exec_timeouts;
+
+/* Every deadline is phase-aligned to timer_base, and every wakeup is rounded
+ * up onto a grid of timer_slack nanoseconds from timer_base. Timers whose
+ * deadlines fall into the same grid slot are run in one wakeup.
+ */
+static u64 timer_base;
+static u64 timer_slack = 50 * NSEC_PER_MSEC;
+
+/* Number of times event thread woke up for timers, used by stats. */
+static u64 nr_wakeups;
+
+/* File descriptors watched by event loop. */
+static LIST_HEAD(fd_head);
+
+/* Timers expired in the same tick are run in parallel by a small pool of
+ * workers. Event thread posts a batch and works on it as well.
+ */
+static int nr_workers = 2;
+
+/* Let timers having max_msecs stretch their periods while quiet. */
+static bool adaptive;
+
+static struct {
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cond;	/* workers wait on this. */
+	pthread_cond_t		done_cond;	/* event thread waits on this. */
+	struct tm_context	*tc;
+	struct tm_thread_timer	**timers;
+	int			nr;
+	int			next;
+	int			nr_done;
+	int			err;
+	u64			busy;		/* sum of timer_cb time. */
+	u64			cpu;		/* sum of timer_cb CPU time. */
+	bool			exit;
+} batch = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.work_cond	= PTHREAD_COND_INITIALIZER,
+	.done_cond	= PTHREAD_COND_INITIALIZER
+};
+
+/* For stats: wall time of ticks vs. summed time of timer_cb. */
+static u64 nr_ticks;
+static u64 tick_wall;
+static u64 tick_busy;
+static u64 tick_cpu;
+
+/* CPU time allowed for one tick. Low priority timers beyond it are deferred
+ * to the next tick, but not more than TM_THREAD_DEFER_MAX times in a row.
+ */
+#define TM_THREAD_DEFER_MAX	3
+static u64 tick_budget;
+static u64 nr_deferrals;
+
+static u64 tm_thread_cpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static u64 tm_thread_timer_period(const struct tm_thread_timer *timer)
+{
+	return (timer->adapt_msecs ? : timer->expires_msecs) * NSEC_PER_MSEC;
+}
+
+/* Round @t up to the next multiple of @step counted from timer_base. */
+static u64 tm_thread_align(u64 t, u64 step)
+{
+	if (!step)
+		return t;
+
+	return timer_base + (t - timer_base + step - 1) / step * step;
+}
+
+static void tm_thread_heap_set(int idx, struct tm_thread_timer *timer)
+{
+	timer_heap[idx] = timer;
+	timer->heap_idx = idx;
+}
+
+static void tm_thread_heap_up(int idx)
+{
+	struct tm_thread_timer *timer;
+
+	timer = timer_heap[idx];
+
+	while (idx) {
+		int parent;
+
+		parent = (idx - 1) / 2;
+		if (timer_heap[parent]->wakeup <= timer->wakeup)
+			break;
+
+		tm_thread_heap_set(idx, timer_heap[parent]);
+		idx = parent;
+	}
+
+	tm_thread_heap_set(idx, timer);
+}
+
+static void tm_thread_heap_down(int idx)
+{
+	struct tm_thread_timer *timer;
+
+	timer = timer_heap[idx];
+
+	for (;;) {
+		int child;
+
+		child = idx * 2 + 1;
+		if (child >= nr_timers)
+			break;
+
+		if (child + 1 < nr_timers &&
+		    timer_heap[child + 1]->wakeup < timer_heap[child]->wakeup)
+			child++;
+
+		if (timer->wakeup <= timer_heap[child]->wakeup)
+			break;
+
+		tm_thread_heap_set(idx, timer_heap[child]);
+		idx = child;
+	}
+
+	tm_thread_heap_set(idx, timer);
+}
+
+static bool tm_thread_timer_armed(struct tm_thread_timer *ttc)
+{
+	return ttc->heap_idx >= 0 && ttc->heap_idx < nr_timers &&
+	       timer_heap[ttc->heap_idx] == ttc;
+}
+
+static int tm_thread_timer_insert(struct tm_thread_timer *ttc)
+{
+	u64 now;
+	int err;
+
+	err = ENOSPC;
+	if (nr_timers >= TM_THREAD_TIMER_MAX) {
+		fprintf(stderr, "%s(%d): too many timers.\n", __func__,
+			__LINE__);
+		goto out;
+	}
+
+	now = tm_now();
+	if (!timer_base)
+		timer_base = now;
+
+	/* Timers are phase-aligned, e.g. 1 sec timer and 3 sec timer expire
+	 * at the same time every 3 secs, no matter when they were added.
+	 */
+	ttc->deadline = tm_thread_align(now + 1, tm_thread_timer_period(ttc));
+	ttc->wakeup = tm_thread_align(ttc->deadline, timer_slack);
+	ttc->overruns = 0;
+
+	tm_thread_heap_set(nr_timers++, ttc);
+	tm_thread_heap_up(ttc->heap_idx);
+
+	err = 0;
+out:
+	return err;
+}
+
+static void tm_thread_timer_remove(struct tm_thread_timer *ttc)
+{
+	struct tm_thread_timer *last;
+	int idx;
+
+	if (!tm_thread_timer_armed(ttc))
+		return;
+
+	idx = ttc->heap_idx;
+
+	ttc->heap_idx = -1;
+
+	last = timer_heap[--nr_timers];
+	if (last == ttc)
+		return;
+
+	/* Fill the hole with the last one, and restore heap order. */
+	tm_thread_heap_set(idx, last);
+	tm_thread_heap_up(idx);
+	tm_thread_heap_down(last->heap_idx);
+}
+
+/* Apply what was requested for @ttc. Only event loop, or anyone while event
+ * loop is not running, may touch the heap.
+ */
+static void tm_thread_timer_apply(struct tm_thread_timer *ttc)
+{
+	int msecs;
+
+	msecs = __atomic_exchange_n(&ttc->want_msecs, 0, __ATOMIC_ACQ_REL);
+	if (msecs > 0 && msecs != ttc->expires_msecs) {
+		ttc->expires_msecs = msecs;
+		ttc->adapt_msecs = 0;
+
+		/* Re-align to the new period from now on. */
+		if (tm_thread_timer_armed(ttc)) {
+			tm_thread_timer_remove(ttc);
+			tm_thread_timer_insert(ttc);
+		}
+	}
+
+	if (__atomic_load_n(&ttc->want_armed, __ATOMIC_ACQUIRE)) {
+		if (!tm_thread_timer_armed(ttc))
+			tm_thread_timer_insert(ttc);
+	} else {
+		tm_thread_timer_remove(ttc);
+	}
+}
+
+/* Take the whole pending stack at once, so there is no ABA problem.
+ * Returns number of timers applied.
+ */
+static int tm_thread_timer_apply_pending(void)
+{
+	struct tm_thread_timer *ttc, *next;
+	int nr;
+
+	nr = 0;
+	ttc = __atomic_exchange_n(&timer_pending, NULL, __ATOMIC_ACQUIRE);
+
+	for (; ttc; ttc = next) {
+		next = ttc->pending_next;
+
+		/* Requests from now on push it again. Applying it twice is
+		 * harmless.
+		 */
+		__atomic_store_n(&ttc->pending, false, __ATOMIC_RELEASE);
+		tm_thread_timer_apply(ttc);
+		nr++;
+	}
+
+	return nr;
+}
+
+/* Wake up event loop if it is there. Otherwise, it will see what is requested
+ * when it starts.
+ */
+static void tm_thread_ev_kick(void)
+{
+	u64 cnt;
+	int fd;
+
+	fd = __atomic_load_n(&ev_wakefd, __ATOMIC_ACQUIRE);
+	if (fd < 0)
+		return;
+
+	cnt = 1;
+	if (write(fd, &cnt, sizeof(cnt)) == -1)
+		pr_err("write");
+}
+
+/* Only event loop touches timer_heap, even before it starts or after it
+ * exits. Requests made then wait on the stack, and are applied when the loop
+ * starts.
+ */
+static void tm_thread_timer_request(struct tm_thread_timer *ttc)
+{
+	struct tm_thread_timer *head;
+
+	/* Already on the stack. Event loop will see the latest request. */
+	if (__atomic_exchange_n(&ttc->pending, true, __ATOMIC_ACQ_REL))
+		return;
+
+	head = __atomic_load_n(&timer_pending, __ATOMIC_RELAXED);
+	do {
+		ttc->pending_next = head;
+	} while (!__atomic_compare_exchange_n(&timer_pending, &head, ttc, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+
+	tm_thread_ev_kick();
+}
+
+int tm_thread_timer_add(struct tm_thread_timer *ttc)
+{
+	int err;
+
+	err = 0;
+
+	/* Forwarding a timer divides by its period. */
+	if (ttc->expires_msecs <= 0) {
+		fprintf(stderr, "%s(%d): invalid period %d.\n",
+			__func__, __LINE__, ttc->expires_msecs);
+		err = EINVAL;
+		goto out;
+	}
+
+	if (!__atomic_exchange_n(&ttc->want_armed, true, __ATOMIC_ACQ_REL)) {
+		/* Reserve a slot now, so that we can fail here. */
+		if (__atomic_add_fetch(&nr_timers_want, 1, __ATOMIC_ACQ_REL) >
+		    TM_THREAD_TIMER_MAX) {
+			__atomic_sub_fetch(&nr_timers_want, 1,
+					   __ATOMIC_ACQ_REL);
+			__atomic_store_n(&ttc->want_armed, false,
+					 __ATOMIC_RELEASE);
+			fprintf(stderr, "%s(%d): too many timers.\n",
+				__func__, __LINE__);
+			err = ENOSPC;
+			goto out;
+		}
+	}
+
+	tm_thread_timer_request(ttc);
+out:
+	return err;
+}
+
+void tm_thread_timer_del(struct tm_thread_timer *ttc)
+{
+	if (__atomic_exchange_n(&ttc->want_armed, false, __ATOMIC_ACQ_REL))
+		__atomic_sub_fetch(&nr_timers_want, 1, __ATOMIC_ACQ_REL);
+
+	tm_thread_timer_request(ttc);
+}
+
+void tm_thread_timer_set_period(struct tm_thread_timer *ttc, int msecs)
+{
+	if (msecs <= 0)
+		return;
+
+	__atomic_store_n(&ttc->want_msecs, msecs, __ATOMIC_RELEASE);
+	tm_thread_timer_request(ttc);
+}
+
+/* Arm tfd for the nearest wakeup. Zero disarms it. */
+static int tm_thread_set_timerfd(int tfd, u64 deadline)
+{
+	struct itimerspec its;
+	int err;
+
+	its = (struct itimerspec){
+		.it_value = {
+			.tv_sec = deadline / NSEC_PER_SEC,
+			.tv_nsec = deadline % NSEC_PER_SEC
+		}
+	};
+	err = timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+	if (err)
+		pr_err("timerfd_settime");
+
+	return err;
+}
+
+/* Next deadline is derived from the ideal one, not from when timer_cb actually
+ * ran, so the period does not drift. When we are late by one or more whole
+ * periods, skip them and record them as overruns rather than firing a burst.
+ */
+static void tm_thread_timer_forward(struct tm_thread_timer *timer, u64 now)
+{
+	u64 period;
+
+	period = tm_thread_timer_period(timer);
+
+	timer->deadline += period;
+	if (timer->deadline <= now) {
+		u64 missed;
+
+		missed = (now - timer->deadline) / period + 1;
+		timer->deadline += missed * period;
+		timer->overruns += missed;
+	}
+
+	timer->wakeup = tm_thread_align(timer->deadline, timer_slack);
+}
+
+/* Timers are added by other objects before we know timer_slack. Put their
+ * wakeups onto the grid now, and rebuild the heap.
+ */
+static void tm_thread_timer_snap_all(void)
+{
+	int i;
+
+	for (i = 0; i < nr_timers; i++)
+		timer_heap[i]->wakeup = tm_thread_align(timer_heap[i]->deadline,
+							timer_slack);
+
+	for (i = nr_timers / 2 - 1; i >= 0; i--)
+		tm_thread_heap_down(i);
+}
+
+static const struct {
+	const char	*name;
+	int		policy;
+} sched_policies[] = {
+	{"other",	SCHED_OTHER},
+	{"batch",	SCHED_BATCH},
+	{"idle",	SCHED_IDLE},
+	{"fifo",	SCHED_FIFO},
+	{"rr",		SCHED_RR}
 };
 
-static struct tm_thread *tm_thread(struct tm_context *tc)
-{
-	return tm_get_object(tc, TM_OBJECT_THREAD);
-}
+static int tm_thread_sched_policy(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sched_policies); i++)
+		if (!strcmp(name, sched_policies[i].name))
+			return sched_policies[i].policy;
+
+	return -1;
+}
+
+static const char *tm_thread_sched_policy_name(int policy)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sched_policies); i++)
+		if (policy == sched_policies[i].policy)
+			return sched_policies[i].name;
+
+	return "unknown";
+}
+
+/* "0,2-3" to @set. */
+static int tm_thread_sched_parse_cpus(const char *s, cpu_set_t *set)
+{
+	char *end;
+
+	CPU_ZERO(set);
+
+	while (*s) {
+		long from, to;
+
+		from = to = strtol(s, &end, 10);
+		if (end == s || from < 0)
+			return 1;
+
+		if (*end == '-') {
+			s = end + 1;
+			to = strtol(s, &end, 10);
+			if (end == s || to < from)
+				return 1;
+		}
+
+		for (; from <= to && from < CPU_SETSIZE; from++)
+			CPU_SET(from, set);
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return 1;
+		s = end;
+	}
+
+	return 0;
+}
+
+static void tm_thread_sched_report(const char *who)
+{
+	struct sched_param param;
+	char cpus[64], *p;
+	int policy, i, len;
+	cpu_set_t set;
+
+	if (pthread_getschedparam(pthread_self(), &policy, &param))
+		policy = -1;
+
+	p = cpus;
+	len = sizeof(cpus);
+	*p = '\0';
+	if (!pthread_getaffinity_np(pthread_self(), sizeof(set), &set)) {
+		for (i = 0; i < CPU_SETSIZE && len > 1; i++) {
+			int n;
+
+			if (!CPU_ISSET(i, &set))
+				continue;
+
+			n = snprintf(p, len, "%s%d", p == cpus ? "" : ",", i);
+			if (n >= len)
+				break;
+			p += n;
+			len -= n;
+		}
+	}
+
+	errno = 0;
+	i = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+	fprintf(stderr, "%s: policy %s, nice %d, cpus %s\n", who,
+		tm_thread_sched_policy_name(policy), errno ? 0 : i,
+		*cpus ? cpus : "?");
+}
+
+void tm_thread_sched_apply(const char *who, const struct tm_thread_sched *ts,
+			   bool report)
+{
+	cpu_set_t set;
+	int err;
+
+	if (ts->policy) {
+		struct sched_param param;
+		int policy;
+
+		policy = tm_thread_sched_policy(ts->policy);
+		if (policy < 0) {
+			fprintf(stderr, "%s: unknown policy \"%s\".\n", who,
+				ts->policy);
+		} else {
+			param.sched_priority =
+				policy == SCHED_FIFO || policy == SCHED_RR ?
+				sched_get_priority_min(policy) : 0;
+			err = pthread_setschedparam(pthread_self(), policy,
+						    &param);
+			if (err) {
+				errno = err;
+				pr_err("pthread_setschedparam");
+			}
+		}
+	}
+
+	/* nice is per thread on Linux. */
+	if (ts->set_nice &&
+	    setpriority(PRIO_PROCESS, syscall(SYS_gettid), ts->nice))
+		pr_err("setpriority");
+
+	if (ts->cpus) {
+		if (tm_thread_sched_parse_cpus(ts->cpus, &set)) {
+			fprintf(stderr, "%s: bad cpu list \"%s\".\n", who,
+				ts->cpus);
+		} else {
+			err = pthread_setaffinity_np(pthread_self(),
+						     sizeof(set), &set);
+			if (err) {
+				errno = err;
+				pr_err("pthread_setaffinity_np");
+			}
+		}
+	}
+
+	if (report && (ts->policy || ts->set_nice || ts->cpus))
+		tm_thread_sched_report(who);
+}
+
+/* Pick the next timer of the batch, and run it with batch.lock dropped.
+ * Called with batch.lock held.
+ */
+static void tm_thread_batch_run_one(void)
+{
+	struct tm_thread_timer *timer;
+	struct tm_context *tc;
+	u64 start, cost, cpu_start, cpu;
+	unsigned long nr_updates;
+	int err;
+
+	tc = batch.tc;
+	timer = batch.timers[batch.next++];
+	pthread_mutex_unlock(&batch.lock);
+
+	/* Don't start a new one if we are asked to stop. */
+	nr_updates = tm_item_nr_updates();
+	start = tm_now();
+	cpu_start = tm_thread_cpu_now();
+	err = tm_should_stop(tc) ? 0 : timer->timer_cb(tc);
+	cpu = tm_thread_cpu_now() - cpu_start;
+	cost = tm_now() - start;
+
+	pthread_mutex_lock(&batch.lock);
+	timer->changed = tm_item_nr_updates() != nr_updates;
+	timer->cost = timer->cost ? (timer->cost * 7 + cpu) / 8 : cpu;
+	batch.cpu += cpu;
+	if (err && !batch.err)
+		batch.err = err;
+	batch.busy += cost;
+	if (++batch.nr_done == batch.nr)
+		pthread_cond_signal(&batch.done_cond);
+}
+
+static void *tm_thread_worker(void *data)
+{
+	tm_thread_sched_apply("worker", &collector_sched, false);
+
+	pthread_mutex_lock(&batch.lock);
+	for (;;) {
+		while (!batch.exit && batch.next >= batch.nr)
+			pthread_cond_wait(&batch.work_cond, &batch.lock);
+
+		if (batch.exit)
+			break;
+
+		tm_thread_batch_run_one();
+	}
+	pthread_mutex_unlock(&batch.lock);
+
+	return NULL;
+}
+
+/* Run @timers in parallel on workers and on this thread, and wait for all of
+ * them.
+ */
+static int tm_thread_batch_run(struct tm_context *tc,
+			       struct tm_thread_timer **timers, int nr)
+{
+	u64 start, busy;
+	int err;
+
+	start = tm_now();
+
+	pthread_mutex_lock(&batch.lock);
+	batch.tc = tc;
+	batch.timers = timers;
+	batch.nr = nr;
+	batch.next = 0;
+	batch.nr_done = 0;
+	batch.err = 0;
+	batch.busy = 0;
+	batch.cpu = 0;
+
+	if (nr > 1)
+		pthread_cond_broadcast(&batch.work_cond);
+
+	/* Don't just wait. We are a worker as well. */
+	while (batch.next < batch.nr)
+		tm_thread_batch_run_one();
+
+	while (batch.nr_done < batch.nr)
+		pthread_cond_wait(&batch.done_cond, &batch.lock);
+
+	err = batch.err;
+	busy = batch.busy;
+	tick_cpu += batch.cpu;
+	batch.nr = batch.next = 0;
+	pthread_mutex_unlock(&batch.lock);
+
+	nr_ticks++;
+	tick_wall += tm_now() - start;
+	tick_busy += busy;
+
+	return err;
+}
+
+static void tm_thread_wake_main(struct tm_context *tc)
+{
+	if (!tm_item_update_needed())
+		return;
+
+	/* Items are already published. Just make sure main sees them. */
+	pthread_mutex_lock(&tc->main_wake_lock);
+	pthread_cond_signal(&tc->main_wake_cond);
+	pthread_mutex_unlock(&tc->main_wake_lock);
+}
+
+/* Stretch the period of a quiet timer, and snap it back once it reports a
+ * change.
+ */
+static void tm_thread_timer_adapt(struct tm_thread_timer *timer, u64 now)
+{
+	int msecs;
+
+	if (!adaptive || timer->max_msecs <= timer->expires_msecs ||
+	    !tm_thread_timer_armed(timer))
+		return;
+
+	if (timer->changed) {
+		msecs = 0;
+	} else {
+		msecs = (timer->adapt_msecs ? : timer->expires_msecs) * 2;
+		if (msecs > timer->max_msecs)
+			msecs = timer->max_msecs;
+	}
+
+	if (msecs == timer->adapt_msecs)
+		return;
+
+	timer->adapt_msecs = msecs;
+	timer->deadline = tm_thread_align(now + 1,
+					  tm_thread_timer_period(timer));
+	timer->wakeup = tm_thread_align(timer->deadline, timer_slack);
+
+	tm_thread_heap_up(timer->heap_idx);
+	tm_thread_heap_down(timer->heap_idx);
+}
+
+static void *tm_thread_exec_run(void *data)
+{
+	struct tm_thread_timer *timer;
+	struct tm_thread_exec *exec;
+	unsigned long nr_updates;
+	bool recovered, report;
+	int i, err;
+
+	exec = data;
+	timer = exec->timer;
+
+	tm_thread_sched_apply("executor", &collector_sched, false);
+
+	pthread_mutex_lock(&exec->lock);
+	for (;;) {
+		while (!exec->exit && !exec->kick)
+			pthread_cond_wait(&exec->cond, &exec->lock);
+
+		if (exec->exit)
+			break;
+
+		exec->kick = false;
+		pthread_mutex_unlock(&exec->lock);
+
+		/* This is what may block. */
+		tm_io_pread(timer->io_files, timer->nr_io_files);
+		nr_updates = tm_item_nr_updates();
+		err = tm_should_stop(exec->tc) ? 0 : timer->timer_cb(exec->tc);
+
+		/* We were left behind busy, and tc may be gone by now. Touch
+		 * nothing.
+		 */
+		pthread_mutex_lock(&exec->lock);
+		if (exec->exit)
+			break;
+
+		__atomic_store_n(&timer->changed,
+				 tm_item_nr_updates() != nr_updates,
+				 __ATOMIC_RELAXED);
+
+		exec->busy = false;
+		recovered = !err && (exec->stale || exec->failed);
+		report = err && !exec->failed;
+		exec->stale = false;
+		exec->failed = !!err;
+		pthread_mutex_unlock(&exec->lock);
+
+		/* A stuck mount usually ends up in an error. Keep running, and
+		 * show it stale until it recovers.
+		 */
+		if (report)
+			fprintf(stderr, "Isolated collector failed (%d). "
+				"Its items are stale until it recovers.\n",
+				err);
+
+		if (err || recovered)
+			for (i = 0; i < timer->nr_items; i++)
+				tm_item_set_stale(&timer->items[i], !!err);
+
+		/* Event loop doesn't wait for us. Let main know by ourselves.
+		 * In single thread mode, main is the event loop in epoll.
+		 */
+		if (!exec->tc->single_thread)
+			tm_thread_wake_main(exec->tc);
+		else if (tm_item_update_needed())
+			tm_thread_ev_kick();
+
+		pthread_mutex_lock(&exec->lock);
+	}
+	pthread_mutex_unlock(&exec->lock);
+
+	return NULL;
+}
+
+static int tm_thread_exec_create(struct tm_context *tc,
+				 struct tm_thread_timer *timer)
+{
+	struct tm_thread_exec *exec;
+	int err;
+
+	err = ENOMEM;
+	exec = calloc(1, sizeof(*exec));
+	if (!exec) {
+		pr_err("calloc");
+		goto out;
+	}
+
+	pthread_mutex_init(&exec->lock, NULL);
+	pthread_cond_init(&exec->cond, NULL);
+	exec->timer = timer;
+	exec->tc = tc;
+
+	err = pthread_create(&exec->tid, NULL, tm_thread_exec_run, exec);
+	if (err) {
+		errno = err;
+		pr_err("pthread_create");
+		free(exec);
+		goto out;
+	}
+
+	timer->exec = exec;
+	execs[nr_execs++] = exec;
+out:
+	return err;
+}
+
+/* Hand @timer over to its executor. Never waits for it. */
+static int tm_thread_exec_kick(struct tm_context *tc,
+			       struct tm_thread_timer *timer, u64 now)
+{
+	struct tm_thread_exec *exec;
+	int err;
+
+	err = 0;
+
+	if (!timer->exec) {
+		err = tm_thread_exec_create(tc, timer);
+		if (err)
+			goto out;
+	}
+
+	exec = timer->exec;
+
+	pthread_mutex_lock(&exec->lock);
+	if (exec->busy) {
+		/* Still stuck in the last one. */
+		exec_skips++;
+	} else {
+		exec->busy = true;
+		exec->kick = true;
+		exec->started = now;
+		pthread_cond_signal(&exec->cond);
+	}
+	pthread_mutex_unlock(&exec->lock);
+out:
+	return err;
+}
+
+static u64 tm_thread_exec_deadline(struct tm_thread_exec *exec)
+{
+	int msecs;
+
+	msecs = exec->timer->timeout_msecs ? : exec->timer->expires_msecs;
+
+	return exec->started + msecs * NSEC_PER_MSEC;
+}
+
+/* Mark items of executors overrunning their deadline stale. Returns the
+ * nearest deadline still to come, or 0.
+ */
+static u64 tm_thread_exec_check(u64 now)
+{
+	struct tm_context *tc;
+	u64 next;
+	int i, j;
+
+	next = 0;
+	tc = NULL;
+
+	for (i = 0; i < nr_execs; i++) {
+		struct tm_thread_exec *exec;
+		u64 deadline;
+
+		exec = execs[i];
+
+		pthread_mutex_lock(&exec->lock);
+		if (!exec->busy || exec->stale)
+			goto unlock;
+
+		deadline = tm_thread_exec_deadline(exec);
+		if (deadline > now) {
+			if (!next || deadline < next)
+				next = deadline;
+			goto unlock;
+		}
+
+		exec->stale = true;
+		exec_timeouts++;
+		for (j = 0; j < exec->timer->nr_items; j++)
+			tm_item_set_stale(&exec->timer->items[j], true);
+		tc = exec->tc;
+unlock:
+		pthread_mutex_unlock(&exec->lock);
+	}
+
+	if (tc)
+		tm_thread_wake_main(tc);
+
+	return next;
+}
+
+static void tm_thread_exec_exit_all(void)
+{
+	int i;
+
+	for (i = 0; i < nr_execs; i++) {
+		struct tm_thread_exec *exec;
+		bool busy;
+
+		exec = execs[i];
+
+		pthread_mutex_lock(&exec->lock);
+		exec->exit = true;
+		busy = exec->busy;
+		pthread_cond_signal(&exec->cond);
+		pthread_mutex_unlock(&exec->lock);
+
+		/* Can't wait for a hung one. Leave it to process exit. It
+		 * quits without touching anything once timer_cb returns, and
+		 * exec is left allocated for it.
+		 */
+		if (busy) {
+			pthread_detach(exec->tid);
+			continue;
+		}
+
+		pthread_join(exec->tid, NULL);
+		exec->timer->exec = NULL;
+		free(exec);
+	}
+
+	nr_execs = 0;
+}
+
+/* Isolated timers go to their executors, and the others are run as a batch
+ * here.
+ */
+static int tm_thread_dispatch(struct tm_context *tc,
+			      struct tm_thread_timer **timers, int nr, u64 now)
+{
+	struct tm_thread_timer *local[TM_THREAD_TIMER_MAX];
+	struct tm_io_file *files[TM_THREAD_IO_MAX];
+	int i, j, err, nr_local, nr_files;
+
+	err = 0;
+	nr_local = nr_files = 0;
+
+	for (i = 0; i < nr && !err; i++) {
+		struct tm_thread_timer *timer;
+
+		timer = timers[i];
+
+		if (timer->flags & TM_THREAD_TIMER_ISOLATED) {
+			err = tm_thread_exec_kick(tc, timer, now);
+			continue;
+		}
+
+		local[nr_local++] = timer;
+		for (j = 0; j < timer->nr_io_files; j++) {
+			/* Too many. Read the rest now. */
+			if (nr_files == ARRAY_SIZE(files)) {
+				tm_io_read(files, nr_files);
+				nr_files = 0;
+			}
+			files[nr_files++] = timer->io_files[j];
+		}
+	}
+
+	if (err || !nr_local)
+		goto out;
+
+	/* Read errors are left to each timer_cb to handle. */
+	tm_io_read(files, nr_files);
 
-/* We would add mutex lock for timer_head. */
-static LIST_HEAD(timer_head);
-/* interval time in milliseconds */
-static int interval_msecs = 3000;
+	err = tm_thread_batch_run(tc, local, nr_local);
+out:
+	return err;
+}
 
-void tm_thread_timer_add(struct tm_thread_timer *ttc)
+/* Drop low priority timers from @due which would exceed tick_budget, and
+ * let them join the next tick. Returns new number of @due.
+ */
+static int tm_thread_timer_budget(struct tm_thread_timer **due, int nr_due)
 {
-	struct tm_thread_timer *timer;
+	struct tm_thread_timer *deferred[TM_THREAD_TIMER_MAX];
+	int i, nr, nr_deferred;
+	u64 sum;
 
-	ttc->orig_expires = ttc->expires_msecs;
+	if (!tick_budget)
+		return nr_due;
 
-	/* Set the smallest expires_msecs to interval_msecs. */
-	if (interval_msecs > ttc->expires_msecs)
-		interval_msecs = ttc->expires_msecs;
+	/* Normal ones run anyway. Isolated ones don't cost us. */
+	sum = 0;
+	for (i = 0; i < nr_due; i++)
+		if (due[i]->prio == TM_THREAD_PRIO_NORMAL &&
+		    !(due[i]->flags & TM_THREAD_TIMER_ISOLATED))
+			sum += due[i]->cost;
 
-	/* mutex lock would be needed. */
-	list_for_each_entry(timer, &timer_head, list) {
-		if (timer->expires_msecs > ttc->expires_msecs)
-			break;
+	nr = nr_deferred = 0;
+	for (i = 0; i < nr_due; i++) {
+		struct tm_thread_timer *timer;
+
+		timer = due[i];
+
+		if (timer->prio == TM_THREAD_PRIO_NORMAL ||
+		    timer->flags & TM_THREAD_TIMER_ISOLATED) {
+			due[nr++] = timer;
+			continue;
+		}
+
+		if (sum + timer->cost <= tick_budget ||
+		    timer->deferred >= TM_THREAD_DEFER_MAX) {
+			sum += timer->cost;
+			timer->deferred = 0;
+			due[nr++] = timer;
+			continue;
+		}
+
+		timer->deferred++;
+		deferred[nr_deferred++] = timer;
+		nr_deferrals++;
+	}
+
+	/* It has been forwarded already. Take it back, and wake it up with
+	 * whichever comes next, so that we don't add wakeups.
+	 */
+	for (i = 0; i < nr_deferred; i++) {
+		struct tm_thread_timer *timer;
+
+		timer = deferred[i];
+		timer->deadline -= tm_thread_timer_period(timer);
+		if (timer_heap[0]->wakeup < timer->wakeup) {
+			timer->wakeup = timer_heap[0]->wakeup;
+			tm_thread_heap_up(timer->heap_idx);
+		}
 	}
 
-	list_add(&ttc->list, &timer->list);
+	return nr;
 }
 
-void tm_thread_timer_del(struct tm_thread_timer *ttc)
+static int tm_thread_timer_expire(struct tm_context *tc)
 {
-	struct tm_thread_timer *timer;
+	struct tm_thread_timer *due[TM_THREAD_TIMER_MAX];
+	int i, err, nr_due;
+	u64 now;
 
-	/* We need mutex lock here ? */
-	list_for_each_entry(timer, &timer_head, list) {
-		if (timer == ttc) {
-			list_del(&timer->list);
-			return;
-		}
+	now = tm_now();
+
+	/* Collect all expired timers, and reschedule them right away. */
+	nr_due = 0;
+	while (nr_timers && timer_heap[0]->wakeup <= now) {
+		due[nr_due++] = timer_heap[0];
+		tm_thread_timer_forward(timer_heap[0], now);
+		tm_thread_heap_down(0);
 	}
+
+	nr_due = tm_thread_timer_budget(due, nr_due);
+	if (!nr_due)
+		return 0;
+
+	err = tm_thread_dispatch(tc, due, nr_due, now);
+	if (err)
+		goto out;
+
+	for (i = 0; i < nr_due; i++)
+		tm_thread_timer_adapt(due[i], now);
+
+	/* All updates of this tick are in. Wake up main thread once. */
+	tm_thread_wake_main(tc);
+out:
+	return err;
 }
 
-static int tm_thread_set_signal_handler(int signum, void (*sig_handler)(int))
+static int tm_thread_rearm(struct tm_thread *thread)
 {
-	struct sigaction act;
-	sigset_t mask;
-	int err;
+	u64 wakeup, timeout;
 
-	/* Install signal handler. */
-	act = (struct sigaction){
-		.sa_handler = sig_handler
-	};
-	err = sigfillset(&act.sa_mask);
-	if (err) {
-		pr_err("sigfillset");
-		goto out;
-	}
-	err = sigaction(signum, &act, NULL);
-	if (err) {
-		pr_err("sigaction");
+	/* Sleep exactly until the next wakeup, or forever if suspended. */
+	wakeup = !suspended && nr_timers ? timer_heap[0]->wakeup : 0;
+
+	/* Or until an executor times out. */
+	timeout = tm_thread_exec_check(tm_now());
+	if (timeout && (!wakeup || timeout < wakeup))
+		wakeup = timeout;
+
+	return tm_thread_set_timerfd(thread->timerfd.fd, wakeup);
+}
+
+/* Follow suspend_req. On resume, what is shown is stale. Take a sample right
+ * now, and restart all periods from here rather than counting overruns.
+ */
+static int tm_thread_update_suspend(struct tm_context *tc)
+{
+	int i, err;
+	bool req;
+	u64 now;
+
+	err = 0;
+
+	req = __atomic_load_n(&suspend_req, __ATOMIC_ACQUIRE);
+	if (req == suspended)
 		goto out;
-	}
 
-	/* Now unblock signum signal. */
-	err = sigemptyset(&mask);
-	if (err) {
-		pr_err("sigemptyset");
+	suspended = req;
+	if (suspended || !nr_timers)
+		goto rearm;
+
+	/* Heap is not touched until batch is done. */
+	now = tm_now();
+	err = tm_thread_dispatch(tc, timer_heap, nr_timers, now);
+	if (err)
 		goto out;
-	}
-	err = sigaddset(&mask, signum);
-	if (err) {
-		pr_err("sigaddset");
+
+	now = tm_now();
+	for (i = 0; i < nr_timers; i++)
+		timer_heap[i]->deadline =
+			tm_thread_align(now + 1,
+					tm_thread_timer_period(timer_heap[i]));
+	tm_thread_timer_snap_all();
+
+	tm_thread_wake_main(tc);
+rearm:
+	err = tm_thread_rearm(tm_thread(tc));
+out:
+	return err;
+}
+
+static void tm_thread_set_suspend(bool suspend)
+{
+	if (__atomic_exchange_n(&suspend_req, suspend, __ATOMIC_ACQ_REL) !=
+	    suspend)
+		tm_thread_ev_kick();
+}
+
+void tm_thread_suspend(struct tm_context *tc)
+{
+	tm_thread_set_suspend(true);
+}
+
+void tm_thread_resume(struct tm_context *tc)
+{
+	tm_thread_set_suspend(false);
+}
+
+static int tm_thread_handle_timerfd(struct tm_context *tc)
+{
+	u64 nr_expires;
+	ssize_t sz;
+	int err, tfd;
+
+	err = 0;
+	tfd = tm_thread(tc)->timerfd.fd;
+
+	sz = read(tfd, &nr_expires, sizeof(nr_expires));
+	if (sz != sizeof(nr_expires)) {
+		/* Nothing expired yet. Not an error. */
+		if (sz == -1 && (errno == EAGAIN || errno == EINTR))
+			goto out;
+		pr_err("read");
+		err = 1;
 		goto out;
 	}
-	err = pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
+	/* Raced with suspend. Executors may still time out. */
+	if (suspended)
+		goto rearm;
+
+	nr_wakeups++;
+
+	err = tm_thread_timer_expire(tc);
 	if (err)
-		pr_err("pthread_sigmask");
+		goto out;
+rearm:
+	err = tm_thread_rearm(tm_thread(tc));
 out:
 	return err;
 }
 
-static int nr_sigint;
-static int nr_sigalrm;
-static pthread_mutex_t tm_sig_lock = PTHREAD_MUTEX_INITIALIZER;
+/* SIGUSR1 makes all timers twice faster, SIGUSR2 twice slower. */
+#define TM_THREAD_PERIOD_MIN	250
+#define TM_THREAD_PERIOD_MAX	3600000
 
-static void tm_thread_sig_record(int signum)
+static void tm_thread_timer_scale_all(bool faster)
 {
-	pthread_mutex_lock(&tm_sig_lock);
-	if (signum == SIGINT)
-		nr_sigint++;
-	else if (signum == SIGALRM)
-		nr_sigalrm++;
-	pthread_mutex_unlock(&tm_sig_lock);
+	int i;
+
+	for (i = 0; i < nr_timers; i++) {
+		struct tm_thread_timer *ttc;
+		int msecs;
+
+		ttc = timer_heap[i];
+		msecs = faster ? ttc->expires_msecs / 2 :
+				 ttc->expires_msecs * 2;
+		if (msecs < TM_THREAD_PERIOD_MIN)
+			msecs = TM_THREAD_PERIOD_MIN;
+		else if (msecs > TM_THREAD_PERIOD_MAX)
+			msecs = TM_THREAD_PERIOD_MAX;
+
+		/* Heap is reordered later by event loop, not under us. */
+		tm_thread_timer_set_period(ttc, msecs);
+	}
 }
 
-static int tm_thread_set_itimer(int interval_msecs)
+static int tm_thread_handle_signalfd(struct tm_context *tc)
 {
-	struct itimerval it;
+	struct signalfd_siginfo si;
+	ssize_t sz;
 	int err;
 
-	it = (struct itimerval){
-		.it_interval = {
-			.tv_sec = interval_msecs / 1000,
-			.tv_usec = (interval_msecs % 1000) * 1000
-		},
-		.it_value = {
-			.tv_sec = interval_msecs / 1000,
-			.tv_usec = (interval_msecs % 1000) * 1000
-		}
-	};
-	err = setitimer(ITIMER_REAL, &it, NULL);
-	if (err)
-		pr_err("setitimer");
+	err = 0;
+
+	while ((sz = read(tm_thread(tc)->sigfd.fd, &si, sizeof(si))) ==
+	       sizeof(si)) {
+		/* We have nothing to reload on SIGHUP. Just stop. */
+		if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM ||
+		    si.ssi_signo == SIGHUP)
+			tm_stop(tc);
+		else if (si.ssi_signo == SIGUSR1)
+			tm_thread_timer_scale_all(true);
+		else if (si.ssi_signo == SIGUSR2)
+			tm_thread_timer_scale_all(false);
+	}
+
+	if (sz == -1 && errno != EAGAIN && errno != EINTR) {
+		pr_err("read");
+		err = 1;
+	}
 
 	return err;
 }
 
-static int tm_thread_sigalrm_handler(struct tm_context *tc)
+void tm_thread_fd_add(struct tm_thread_fd *tfd)
 {
-	struct tm_thread_timer *timer;
+	list_add_tail(&tfd->list, &fd_head);
+}
+
+void tm_thread_fd_del(struct tm_thread_fd *tfd)
+{
+	list_del_init(&tfd->list);
+}
+
+static int tm_thread_handle_eventfd(struct tm_context *tc)
+{
+	u64 cnt;
+
+	/* Just woken up. Event loop checks what to do. */
+	if (read(tm_thread(tc)->wakefd.fd, &cnt, sizeof(cnt)) == -1 &&
+	    errno != EAGAIN && errno != EINTR) {
+		pr_err("read");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Wake up event loop from any thread. */
+void tm_thread_wake(struct tm_context *tc)
+{
+	u64 cnt;
+
+	cnt = 1;
+	if (write(tm_thread(tc)->wakefd.fd, &cnt, sizeof(cnt)) == -1)
+		pr_err("write");
+}
+
+static int tm_thread_signalfd_init(struct tm_thread *thread)
+{
+	sigset_t mask;
 	int err;
 
-	/* Find which timers are expired. */
-	list_for_each_entry(timer, &timer_head, list) {
-		timer->expires_msecs -= interval_msecs;
-		if (timer->expires_msecs <= 0) {
-			timer->expires_msecs += timer->orig_expires;
-			err = timer->timer_cb(tc);
-			if (err)
-				goto out;
-		}
+	err = sigemptyset(&mask) || sigaddset(&mask, SIGINT) ||
+	      sigaddset(&mask, SIGTERM) || sigaddset(&mask, SIGHUP) ||
+	      sigaddset(&mask, SIGUSR1) || sigaddset(&mask, SIGUSR2);
+	if (err) {
+		pr_err("sigaddset");
+		goto out;
 	}
 
-	if (tm_item_update_needed()) {
-		/* Wake up main thread. */
-		pthread_mutex_lock(&tc->main_wake_lock);
-		tm_item_update_replace(&tc->list_update);
-		pthread_cond_signal(&tc->main_wake_cond);
-		pthread_mutex_unlock(&tc->main_wake_lock);
+	/* These are already blocked in all threads by main object. */
+	thread->sigfd.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (thread->sigfd.fd == -1) {
+		pr_err("signalfd");
+		err = 1;
+		goto out;
 	}
 
-	err = 0;
+	thread->sigfd.fd_cb = tm_thread_handle_signalfd;
+	tm_thread_fd_add(&thread->sigfd);
 out:
 	return err;
 }
 
-static int tm_thread_sigint_handler(struct tm_context *tc)
+static int tm_thread_ev_init(struct tm_context *tc)
 {
-	tc->should_stop = true;
+	struct tm_thread *thread;
+	struct tm_thread_fd *tfd;
+	int err;
 
-/* XXX */
-//tm_x_send_expose_event(tc);
+	err = 1;
+	thread = tm_thread(tc);
 
-	return 0;
+	thread->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epfd == -1) {
+		pr_err("epoll_create1");
+		goto out;
+	}
+
+	thread->timerfd.fd = timerfd_create(CLOCK_MONOTONIC,
+					    TFD_NONBLOCK | TFD_CLOEXEC);
+	if (thread->timerfd.fd == -1) {
+		pr_err("timerfd_create");
+		goto err_close_epfd;
+	}
+	thread->timerfd.fd_cb = tm_thread_handle_timerfd;
+	tm_thread_fd_add(&thread->timerfd);
+
+	thread->wakefd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (thread->wakefd.fd == -1) {
+		pr_err("eventfd");
+		goto err_close_tfd;
+	}
+	thread->wakefd.fd_cb = tm_thread_handle_eventfd;
+	tm_thread_fd_add(&thread->wakefd);
+	__atomic_store_n(&ev_wakefd, thread->wakefd.fd, __ATOMIC_RELEASE);
+
+	err = tm_thread_signalfd_init(thread);
+	if (err)
+		goto err_close_wakefd;
+
+	list_for_each_entry(tfd, &fd_head, list) {
+		struct epoll_event ev;
+
+		ev = (struct epoll_event){
+			.events		= EPOLLIN,
+			.data.ptr	= tfd
+		};
+		err = epoll_ctl(thread->epfd, EPOLL_CTL_ADD, tfd->fd, &ev);
+		if (err) {
+			pr_err("epoll_ctl");
+			goto err_close_sigfd;
+		}
+	}
+out:
+	return err;
+err_close_sigfd:
+	tm_thread_fd_del(&thread->sigfd);
+	close(thread->sigfd.fd);
+err_close_wakefd:
+	__atomic_store_n(&ev_wakefd, -1, __ATOMIC_RELEASE);
+	tm_thread_fd_del(&thread->wakefd);
+	close(thread->wakefd.fd);
+err_close_tfd:
+	tm_thread_fd_del(&thread->timerfd);
+	close(thread->timerfd.fd);
+err_close_epfd:
+	close(thread->epfd);
+	goto out;
 }
 
-static int tm_thread_handle_events(struct tm_context *tc)
+static void tm_thread_ev_exit(struct tm_context *tc)
 {
-	int err, sigint_cnt, sigalrm_cnt;
+	struct tm_thread *thread;
+
+	thread = tm_thread(tc);
 
-	sigint_cnt = sigalrm_cnt = 0;
+	tm_thread_fd_del(&thread->sigfd);
+	close(thread->sigfd.fd);
+	__atomic_store_n(&ev_wakefd, -1, __ATOMIC_RELEASE);
+	tm_thread_fd_del(&thread->wakefd);
+	close(thread->wakefd.fd);
+	tm_thread_fd_del(&thread->timerfd);
+	close(thread->timerfd.fd);
+	close(thread->epfd);
+}
 
-	pthread_mutex_lock(&tm_sig_lock);
-	/* Avoid write to nr_sigint and nr_sigalrm if possible. */
-	if (nr_sigint) {
-		sigint_cnt = nr_sigint;
-		nr_sigint = 0;
-	}
-	if (nr_sigalrm) {
-		sigalrm_cnt = nr_sigalrm;
-		nr_sigalrm = 0;
-	}
-	pthread_mutex_unlock(&tm_sig_lock);
+/* Some sources buffer input in user space (e.g. xcb event queue), and epoll
+ * can't tell us about it. Let them handle it before we go to sleep.
+ */
+static int tm_thread_fd_prepare(struct tm_context *tc)
+{
+	struct tm_thread_fd *tfd;
+	int err;
+
+	err = 0;
 
-	while (sigalrm_cnt--) {
-		err = tm_thread_sigalrm_handler(tc);
+	list_for_each_entry(tfd, &fd_head, list) {
+		if (!(tfd->flags & TM_THREAD_FD_PREPARE))
+			continue;
+
+		err = tfd->fd_cb(tc);
 		if (err)
-			goto out;
+			break;
 	}
-	while (sigint_cnt--) {
-		err = tm_thread_sigint_handler(tc);
-		if (err)
-			goto out;
+
+	return err;
+}
+
+int tm_thread_run(struct tm_context *tc)
+{
+	struct tm_thread *thread;
+	int err;
+
+	thread = tm_thread(tc);
+
+	/* Drawing is done here as well, but collector settings win. */
+	if (tc->single_thread)
+		tm_thread_sched_apply("single thread", &collector_sched, true);
+
+	/* Let the kernel coalesce our own wakeups with others' as well. */
+	if (timer_slack && prctl(PR_SET_TIMERSLACK, timer_slack))
+		pr_err("prctl");
+
+	/* Apply what is requested before we start. */
+	tm_thread_timer_apply_pending();
+
+	err = tm_thread_rearm(thread) || tm_thread_update_suspend(tc);
+
+	while (!tm_should_stop(tc) && !err) {
+		struct epoll_event evs[4];
+		int i, nr_evs, timeout;
+
+		/* In single thread mode, drawing is done here as well, when
+		 * a frame is due. Otherwise, sleep until it is. Drawing may
+		 * read X events into xcb queue, so repeat until nothing is
+		 * left to draw.
+		 */
+		timeout = -1;
+		if (tc->single_thread) {
+			for (;;) {
+				err = tm_thread_fd_prepare(tc);
+				if (err || tm_should_stop(tc))
+					break;
+
+				timeout = tm_frame_timeout(tc);
+				if (timeout)
+					break;
+
+				tm_draw(tc);
+			}
+
+			if (err || tm_should_stop(tc))
+				break;
+		}
+
+		nr_evs = epoll_wait(thread->epfd, evs, ARRAY_SIZE(evs),
+				    timeout);
+		if (nr_evs == -1) {
+			if (errno == EINTR)
+				continue;
+			pr_err("epoll_wait");
+			err = 1;
+			break;
+		}
+
+		if (tm_should_stop(tc))
+			break;
+
+		for (i = 0; i < nr_evs && !err; i++) {
+			struct tm_thread_fd *tfd;
+
+			tfd = evs[i].data.ptr;
+			err = tfd->fd_cb(tc);
+		}
+
+		/* Nearest wakeup may have changed. */
+		if (!err && tm_thread_timer_apply_pending())
+			err = tm_thread_rearm(thread);
+
+		if (!err)
+			err = tm_thread_update_suspend(tc);
 	}
-out:
+
+	if (err)
+		tm_stop(tc);
+
 	return err;
 }
 
 static void *tm_thread_event_manager(void *data)
 {
 	struct tm_context *tc;
-	int err;
 
 	tc = data;
 
@@ -211,29 +1540,122 @@ static void *tm_thread_event_manager(void *data)
 		pthread_cond_wait(&tc->init_cond, &tc->init_lock);
 	pthread_mutex_unlock(&tc->init_lock);
 
-	err = tm_thread_set_signal_handler(SIGINT, SIG_DFL) ||
-	      tm_thread_set_signal_handler(SIGALRM, tm_thread_sig_record);
-	if (err)
-		goto out;
+	tm_thread_sched_apply("collector", &collector_sched, true);
 
-	err = tm_thread_set_itimer(interval_msecs);
+	tm_thread_run(tc);
 
-	while (!tc->should_stop && !err) {
-		pause();
+	return NULL;
+}
 
-		if (tc->should_stop)
-			break;
+static int tm_thread_parse_opts(int argc, char **argv)
+{
+	int i, err;
+	long val;
+
+	err = 1;
 
-		err = tm_thread_handle_events(tc);
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--timer_slack")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--timer_slack needs argument.\n");
+				goto out;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], 0, INT_MAX,
+					 &val))
+				goto out;
+			timer_slack = val * NSEC_PER_MSEC;
+		} else if (!strcmp(argv[i], "--tick_budget")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--tick_budget needs argument.\n");
+				goto out;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], 0, INT_MAX,
+					 &val))
+				goto out;
+			tick_budget = val * 1000ULL;
+		} else if (!strcmp(argv[i], "--collector_sched")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--collector_sched needs argument.\n");
+				goto out;
+			}
+			collector_sched.policy = argv[i];
+		} else if (!strcmp(argv[i], "--collector_nice")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--collector_nice needs argument.\n");
+				goto out;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], -20, 19, &val))
+				goto out;
+			collector_sched.nice = val;
+			collector_sched.set_nice = true;
+		} else if (!strcmp(argv[i], "--collector_cpus")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--collector_cpus needs argument.\n");
+				goto out;
+			}
+			collector_sched.cpus = argv[i];
+		} else if (!strcmp(argv[i], "--disable_io_uring")) {
+			use_uring = false;
+		} else if (!strcmp(argv[i], "--adaptive")) {
+			adaptive = true;
+		} else if (!strcmp(argv[i], "--workers")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--workers needs argument.\n");
+				goto out;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], 0,
+					 TM_THREAD_WORKER_MAX, &val))
+				goto out;
+			nr_workers = val;
+		}
 	}
+
+	err = 0;
 out:
-	if (err)
-		tc->should_stop = true;
+	return err;
+}
 
-	if (tc->should_stop)
-		pthread_cond_signal(&tc->main_wake_cond);
+static void tm_thread_workers_exit(struct tm_thread *thread)
+{
+	int i;
 
-	return NULL;
+	pthread_mutex_lock(&batch.lock);
+	batch.exit = true;
+	pthread_cond_broadcast(&batch.work_cond);
+	pthread_mutex_unlock(&batch.lock);
+
+	for (i = 0; i < thread->nr_workers_running; i++)
+		pthread_join(thread->tid_workers[i], NULL);
+
+	thread->nr_workers_running = 0;
+}
+
+static int tm_thread_workers_init(struct tm_thread *thread)
+{
+	int i, err;
+
+	err = 0;
+	thread->nr_workers_running = 0;
+
+	for (i = 0; i < nr_workers; i++) {
+		err = pthread_create(&thread->tid_workers[i], NULL,
+				     tm_thread_worker, NULL);
+		if (err) {
+			errno = err;
+			pr_err("pthread_create");
+			tm_thread_workers_exit(thread);
+			break;
+		}
+		thread->nr_workers_running++;
+	}
+
+	return err;
 }
 
 static int tm_thread_init(struct tm_context *tc, int argc, char **argv)
@@ -243,14 +1665,44 @@ static int tm_thread_init(struct tm_context *tc, int argc, char **argv)
 
 	thread = tm_thread(tc);
 
+	err = tm_thread_parse_opts(argc, argv);
+	if (err)
+		goto out;
+
+	tm_thread_timer_snap_all();
+
+	/* All objects have opened their files by now. */
+	err = tm_io_init(use_uring);
+	if (err)
+		goto out;
+
+	err = tm_thread_ev_init(tc);
+	if (err)
+		goto err_io;
+
+	/* In single thread mode, main thread runs event loop by itself. */
+	if (tc->single_thread)
+		goto out;
+
+	err = tm_thread_workers_init(thread);
+	if (err)
+		goto err;
+
 	err = pthread_create(&thread->tid_ev_mnger, NULL,
 			     tm_thread_event_manager, tc);
 	if (err) {
 		errno = err;
 		pr_err("pthread_create");
+		tm_thread_workers_exit(thread);
+		goto err;
 	}
-
+out:
 	return err;
+err:
+	tm_thread_ev_exit(tc);
+err_io:
+	tm_io_exit();
+	goto out;
 }
 
 static void tm_thread_exit(struct tm_context *tc)
@@ -259,13 +1711,86 @@ static void tm_thread_exit(struct tm_context *tc)
 
 	thread = tm_thread(tc);
 
-	pthread_join(thread->tid_ev_mnger, NULL);
+	if (!tc->single_thread) {
+		pthread_join(thread->tid_ev_mnger, NULL);
+		tm_thread_workers_exit(thread);
+	}
+
+	tm_thread_exec_exit_all();
+
+	tm_thread_ev_exit(tc);
+	tm_io_exit();
+}
+
+static void tm_thread_help(struct tm_context *tc)
+{
+	printf("\n\ttimer\n"
+	       "\t--timer_slack <MSECS>\n"
+	       "\t\tTimers expiring within this slack are run in one wakeup.\n"
+	       "\t\t0 disables coalescing. Default is 50.\n"
+	       "\t--workers <NUMBER>\n"
+	       "\t\tThreads running timers expired at the same time in parallel.\n"
+	       "\t\t0 runs them one by one. Default is 2.\n"
+	       "\t--tick_budget <USECS>\n"
+	       "\t\tCPU time for one tick. Low priority collectors beyond it\n"
+	       "\t\tare deferred to the next tick. 0 (default) is unlimited.\n"
+	       "\t--collector_sched <other|batch|idle|fifo|rr>\n"
+	       "\t\tScheduling policy of collector threads. e.g. idle never\n"
+	       "\t\ttakes CPU from others.\n"
+	       "\t--collector_nice <NICE>\n"
+	       "\t--collector_cpus <CPU-LIST>\n"
+	       "\t\tPin collector threads to CPUs. e.g. '0,2-3'\n"
+	       "\t--disable_io_uring\n"
+	       "\t\tRead source files by pread one by one.\n"
+	       "\t--adaptive\n"
+	       "\t\tSample less often while values don't change.\n"
+	       "\tSend SIGUSR1 to sample twice faster, SIGUSR2 twice slower.\n");
+}
+
+static void tm_thread_stats(struct tm_context *tc)
+{
+	static u64 last_time, last_wakeups;
+	u64 now, overruns;
+	int i;
+
+	now = tm_now();
+
+	overruns = 0;
+	for (i = 0; i < nr_timers; i++)
+		overruns += timer_heap[i]->overruns;
+
+	if (last_time)
+		fprintf(stderr, "timer: %.2f wakeups/s, %llu wakeups, "
+			"%llu overruns\n",
+			(double)(nr_wakeups - last_wakeups) * NSEC_PER_SEC /
+			(now - last_time), (unsigned long long)nr_wakeups,
+			(unsigned long long)overruns);
+
+	if (nr_ticks)
+		fprintf(stderr, "timer: %.3f ms wall / %.3f ms collectors / "
+			"%.3f ms cpu per tick, %llu deferred\n",
+			(double)tick_wall / nr_ticks / NSEC_PER_MSEC,
+			(double)tick_busy / nr_ticks / NSEC_PER_MSEC,
+			(double)tick_cpu / nr_ticks / NSEC_PER_MSEC,
+			(unsigned long long)nr_deferrals);
+
+	if (nr_execs)
+		fprintf(stderr, "timer: %llu isolated timeouts, %llu skipped\n",
+			(unsigned long long)exec_timeouts,
+			(unsigned long long)exec_skips);
+
+	tm_io_stats();
+
+	last_time = now;
+	last_wakeups = nr_wakeups;
 }
 
 static struct tm_object tm_thread_obj = {
 	.obj_size	= sizeof(struct tm_thread),
 	.init		= tm_thread_init,
-	.exit		= tm_thread_exit
+	.exit		= tm_thread_exit,
+	.help		= tm_thread_help,
+	.stats		= tm_thread_stats
 };
 
 __attribute__((constructor))
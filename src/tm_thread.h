@@ -2,15 +2,141 @@
 #define _TM_THREAD_H
 
 #include "tm.h"
+#include "tm_io.h"
 
+/**
+ * @TM_THREAD_TIMER_ISOLATED: timer_cb may block (e.g. statfs on a hung NFS
+ * mount). It runs on its own executor thread, so that it never holds up other
+ * timers. If it takes longer than timeout_msecs, its items are marked stale,
+ * and it is skipped until it returns.
+ */
+enum {
+	TM_THREAD_TIMER_ISOLATED	= (1 << 0)
+};
+
+/**
+ * @TM_THREAD_PRIO_NORMAL: Always run when expired.
+ * @TM_THREAD_PRIO_LOW: May be deferred to the next tick when the tick would
+ * exceed --tick_budget.
+ */
+enum {
+	TM_THREAD_PRIO_NORMAL	= 0,
+	TM_THREAD_PRIO_LOW
+};
+
+struct tm_thread_exec;
+
+/**
+ * @timer_cb: Called on event thread each time the timer expires.
+ * @expires_msecs: Period in milliseconds. Use tm_thread_timer_set_period()
+ * once the timer is added.
+ * @max_msecs: In adaptive mode, period doubles up to this while timer_cb
+ * changes no item, and goes back to @expires_msecs once it does. 0 means
+ * fixed period.
+ * @flags: TM_THREAD_TIMER_*.
+ * @timeout_msecs: For TM_THREAD_TIMER_ISOLATED. 0 means @expires_msecs.
+ * @items, @nr_items: Items updated by timer_cb, marked stale on timeout,
+ * or while an isolated timer_cb fails.
+ * @prio: TM_THREAD_PRIO_*.
+ * @io_files, @nr_io_files: Files read for timer_cb right before it is called.
+ * Reads of all timers expiring together are done in one batch.
+ *
+ * Others are work area. Never touch!
+ * @deadline: Next ideal expiration in CLOCK_MONOTONIC nanoseconds.
+ * @wakeup: @deadline rounded up onto the coalescing grid. Heap key.
+ * @heap_idx: Position in the timer heap.
+ * @overruns: Number of periods missed because we ran late.
+ * @adapt_msecs: Stretched period in adaptive mode, or 0.
+ * @changed: Last timer_cb changed some items.
+ * @exec: Executor of TM_THREAD_TIMER_ISOLATED timer.
+ * @cost: Average CPU time of timer_cb in nanoseconds.
+ * @deferred: Number of ticks deferred in a row.
+ * @want_armed: Requested state, applied by event loop.
+ * @want_msecs: Requested period, or 0 if none.
+ * @pending: Set while the timer is on the pending stack.
+ * @pending_next: Link of the pending stack.
+ */
 struct tm_thread_timer {
-	struct list_head	list;
 	int			(*timer_cb)(struct tm_context *tc);
-	int			expires_msecs;	/* expires in milliseconds. */
-	int			orig_expires;	/* Never touch! work area.*/
+	int			expires_msecs;
+	int			max_msecs;
+	u32			flags;
+	int			timeout_msecs;
+	struct tm_item		*items;
+	int			nr_items;
+	int			prio;
+	struct tm_io_file	**io_files;
+	int			nr_io_files;
+
+	u64			deadline;
+	u64			wakeup;
+	int			heap_idx;
+	u64			overruns;
+	int			adapt_msecs;
+	bool			changed;
+	struct tm_thread_exec	*exec;
+	u64			cost;
+	int			deferred;
+	bool			want_armed;
+	int			want_msecs;
+	bool			pending;
+	struct tm_thread_timer	*pending_next;
 };
 
-extern void tm_thread_timer_add(struct tm_thread_timer *ttc);
+/**
+ * @TM_THREAD_FD_PREPARE: fd_cb is also called before event loop goes to
+ * sleep. For sources which may buffer input in user space (e.g. xcb).
+ */
+enum {
+	TM_THREAD_FD_PREPARE	= (1 << 0)
+};
+
+/**
+ * @fd: Watched for input by event loop.
+ * @fd_cb: Called on event loop when @fd is readable. Must not block.
+ * @flags: TM_THREAD_FD_*.
+ */
+struct tm_thread_fd {
+	struct list_head	list;
+	int			fd;
+	int			(*fd_cb)(struct tm_context *tc);
+	u32			flags;
+};
+
+/**
+ * Scheduling of a thread. Anything left unset is inherited.
+ * @policy: "other", "batch", "idle", "fifo" or "rr". NULL leaves it.
+ * @nice: Applied if @set_nice.
+ * @cpus: CPU list like "0,2-3". NULL leaves it.
+ */
+struct tm_thread_sched {
+	const char	*policy;
+	int		nice;
+	bool		set_nice;
+	const char	*cpus;
+};
+
+/* Apply @ts to the calling thread. Failures are only logged. */
+extern void tm_thread_sched_apply(const char *who,
+				  const struct tm_thread_sched *ts,
+				  bool report);
+
+/* Timers can be added, deleted and changed from any thread, even from their
+ * own timer_cb. While event loop is running, requests are applied by event
+ * loop asynchronously, so timer_cb may still run once after
+ * tm_thread_timer_del() returns.
+ */
+extern int tm_thread_timer_add(struct tm_thread_timer *ttc);
 extern void tm_thread_timer_del(struct tm_thread_timer *ttc);
+extern void tm_thread_timer_set_period(struct tm_thread_timer *ttc,
+				       int msecs);
+/* fds must be added before thread object is initialized. */
+extern void tm_thread_fd_add(struct tm_thread_fd *tfd);
+extern void tm_thread_fd_del(struct tm_thread_fd *tfd);
+extern int tm_thread_run(struct tm_context *tc);
+extern void tm_thread_wake(struct tm_context *tc);
+/* Stop sampling while nobody can see us. Resuming takes a sample at once. */
+extern void tm_thread_suspend(struct tm_context *tc);
+extern void tm_thread_resume(struct tm_context *tc);
 
 #endif /* _TM_THREAD_H */
@@ -3,6 +3,7 @@
 
 #include "tm_stddef.h"
 #include <stdint.h>
+#include <time.h>
 
 typedef _Bool		bool;
 typedef int8_t		s8;
@@ -14,4 +15,17 @@ typedef uint16_t	u16;
 typedef uint32_t	u32;
 typedef uint64_t	u64;
 
+#define NSEC_PER_MSEC	1000000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+/* Current CLOCK_MONOTONIC time in nanoseconds. */
+static inline u64 tm_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
 #endif	/* _TM_TYPES_H */
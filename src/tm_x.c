@@ -1,5 +1,7 @@
 #include "tm_x.h"
 #include "tm_main.h"
+#include "tm_thread.h"
+#include "tm_glyph.h"
 #include <stdlib.h>
 #include <pango/pangocairo.h>
 #include <librsvg/rsvg.h>
@@ -22,13 +24,40 @@ struct tm_x {
 	double			icon_scale_factor;
 	double			side_icon_scale_factor;
 	const char		*font_desc;
+	bool			use_glyph;
+	struct tm_thread_sched	sched;	/* for X and drawing threads. */
 
 	/* Other variables. */
 	xcb_connection_t	*c;
 	xcb_visualtype_t	*v;
 	xcb_window_t		win;
+	/* Everything is drawn into @surface, an image surface in client
+	 * memory, and only @damage of it is copied onto the window at
+	 * tm_x_flush().
+	 */
 	cairo_t			*cr;
 	cairo_surface_t		*surface;
+	cairo_t			*win_cr;
+	cairo_surface_t		*win_surface;
+	cairo_region_t		*damage;
+
+	/* Items are not drawn right away, but queued until tm_x_flush(), so
+	 * that all of their areas in @item_damage are cleared at once.
+	 */
+	u16			pending[TM_ITEM_MAX];
+	bool			queued[TM_ITEM_MAX];
+	int			nr_pending;
+	cairo_region_t		*item_damage;
+
+	/* Each item has its own layout, so that text which is the same as
+	 * last time is neither shaped nor measured again.
+	 */
+	struct tm_x_text {
+		PangoLayout	*layout;
+		int		width;
+		u32		len;
+		char		str[ITEM_STR_MAX];
+	} texts[TM_ITEM_MAX];
 	PangoLayout		*layout;
 	int			font_max_height;
 	int			font_dot_width;
@@ -37,6 +66,19 @@ struct tm_x {
 	double			margin;
 
 	pthread_t		tid_wait_ev;
+	struct tm_thread_fd	xfd;	/* single thread mode only. */
+
+	/* Nobody can see us if either is true. */
+	bool			unmapped;
+	bool			obscured;
+
+	/* For stats. */
+	u64			nr_blits;
+	u64			nr_blit_rects;
+	u64			blit_pixels;
+	u64			blit_ns;
+	u64			nr_shaped;
+	u64			nr_cached;
 };
 
 static struct tm_x *tm_x(struct tm_context *tc)
@@ -44,14 +86,28 @@ static struct tm_x *tm_x(struct tm_context *tc)
 	return tm_get_object(tc, TM_OBJECT_X);
 }
 
-void tm_x_flush(struct tm_context *tc)
+/* Add the area at @pos_x, @pos_y in user space to @region. Overlapping and
+ * adjacent ones are merged by cairo.
+ */
+static void tm_x_damage(struct tm_x *x, cairo_region_t *region, double pos_x,
+			double pos_y, double width, double height)
 {
-	struct tm_x *x;
-
-	x = tm_x(tc);
-
-	cairo_surface_flush(x->surface);
-	xcb_flush(x->c);
+	cairo_rectangle_int_t r;
+	double x1, y1, x2, y2;
+
+	x1 = pos_x;
+	y1 = pos_y;
+	x2 = pos_x + width;
+	y2 = pos_y + height;
+	cairo_user_to_device(x->cr, &x1, &y1);
+	cairo_user_to_device(x->cr, &x2, &y2);
+
+	r.x = floor(x1);
+	r.y = floor(y1);
+	r.width = ceil(x2) - r.x;
+	r.height = ceil(y2) - r.y;
+
+	cairo_region_union_rectangle(region, &r);
 }
 
 u32 tm_x_get_color_from_str(const char *s)
@@ -284,6 +340,12 @@ static void tm_x_set_source_rgb(cairo_t *cr, u32 col)
 			     tm_x_get_blue(col));
 }
 
+/* Half way between @fg and @bg. */
+static u32 tm_x_blend(u32 fg, u32 bg)
+{
+	return ((fg >> 1) & 0x7f7f7f) + ((bg >> 1) & 0x7f7f7f);
+}
+
 static void tm_x_clear_area(struct tm_x *x, double pos_x, double pos_y,
 			    double width, double height)
 {
@@ -294,6 +356,8 @@ static void tm_x_clear_area(struct tm_x *x, double pos_x, double pos_y,
 	if (!width || !height)
 		return;
 
+	tm_x_damage(x, x->damage, pos_x, pos_y, width, height);
+
 	cairo_rectangle(cr, pos_x, pos_y, width, height);
 #if 0
 	tm_x_set_source_rgb(cr, item->bg);
@@ -316,7 +380,6 @@ void tm_x_draw_icon(struct tm_context *tc, struct tm_icon *icon, double pos_x,
 
 	cairo_set_source_surface(cr, icon->surface, pos_x, pos_y);
 	cairo_paint(cr);
-	cairo_set_source_surface(cr, x->surface, 0, 0);
 }
 
 static void tm_x_set_dash(struct tm_x *x)
@@ -327,8 +390,8 @@ static void tm_x_set_dash(struct tm_x *x)
 void tm_x_draw_line(struct tm_context *tc, double pos_x, double pos_y)
 {
 	struct tm_x *x;
+	double len, lw;
 	cairo_t *cr;
-	double len;
 
 	x = tm_x(tc);
 	cr = x->cr;
@@ -341,55 +404,291 @@ void tm_x_draw_line(struct tm_context *tc, double pos_x, double pos_y)
 	tm_x_set_source_rgb(cr, x->x_fg);
 	cairo_stroke(cr);
 	cairo_restore(cr);
+
+	/* Round caps stick out by half the line width. */
+	lw = x->cairo_line_width;
+	tm_x_damage(x, x->damage, pos_x - lw, pos_y - lw, len + lw * 2,
+		    lw * 2);
 }
 
-void tm_x_draw_text_one(struct tm_context *tc, struct tm_item *item)
+/* Layout of item @idx holding @str. Shaped only when @str differs from
+ * the last one.
+ */
+static struct tm_x_text *tm_x_item_layout(struct tm_x *x, int idx,
+					  const char *str, size_t len)
 {
-	PangoLayout *layout;
-	struct tm_x *x;
+	struct tm_x_text *text;
+
+	text = &x->texts[idx];
+
+	if (text->layout && text->len == len && !memcmp(text->str, str, len)) {
+		x->nr_cached++;
+		return text;
+	}
+
+	if (!text->layout)
+		text->layout = pango_layout_copy(x->layout);
+
+	pango_layout_set_text(text->layout, str, len);
+	pango_layout_get_pixel_size(text->layout, &text->width, NULL);
+	memcpy(text->str, str, len);
+	text->len = len;
+	x->nr_shaped++;
+
+	return text;
+}
+
+static void tm_x_draw_text(struct tm_x *x, int idx)
+{
+	struct tm_x_text *text;
+	char str[ITEM_STR_MAX];
+	u32 flags, col;
+	int width;
 	cairo_t *cr;
 	double dx;
+	size_t len;
+
+	cr = x->cr;
+
+	len = tm_item_read(idx, str);
+	if (!len)
+		return;
+
+	flags = __atomic_load_n(&tm_items.flags[idx], __ATOMIC_RELAXED);
+	col = tm_items.fg[idx];
+	if (flags & TM_ITEM_STALE)
+		col = tm_x_blend(col, x->x_bg);
+
+	/* Numbers and units are copied from the glyph atlas. Others are
+	 * shaped by Pango.
+	 */
+	text = NULL;
+	width = x->use_glyph ? tm_glyph_width(col, str, len) : -1;
+	if (width < 0) {
+		text = tm_x_item_layout(x, idx, str, len);
+		width = text->width;
+	}
+
+	dx = tm_items.x[idx];
+	if (flags & TM_ITEM_WIDTH_CHANGEABLE) {
+		/* Growing past the old area, which is already blank. Only the
+		 * window needs to know.
+		 */
+		tm_items.width[idx] = (double)width;
+		tm_x_damage(x, x->damage, dx, tm_items.y[idx], width,
+			    tm_items.height[idx]);
+	} else if (flags & TM_ITEM_ALIGN_RIGHT) {
+		dx += tm_items.width[idx] - (double)width;
+	}
+
+	if (!text) {
+		tm_glyph_draw(cr, col, dx, tm_items.y[idx], str, len);
+		return;
+	}
+
+	tm_x_set_source_rgb(cr, col);
+	cairo_move_to(cr, dx, tm_items.y[idx]);
+	pango_cairo_show_layout(cr, text->layout);
+}
+
+/* Items have absolute geometry. Call without translation. Drawn at
+ * tm_x_flush().
+ */
+void tm_x_draw_item(struct tm_context *tc, int idx)
+{
+	struct tm_x *x;
+
+	x = tm_x(tc);
+
+	if (x->queued[idx])
+		return;
+
+	x->queued[idx] = true;
+	x->pending[x->nr_pending++] = idx;
+
+	if (!tm_items.width[idx] || !tm_items.height[idx])
+		return;
+
+	tm_x_damage(x, x->item_damage, tm_items.x[idx], tm_items.y[idx],
+		    tm_items.width[idx], tm_items.height[idx]);
+	tm_x_damage(x, x->damage, tm_items.x[idx], tm_items.y[idx],
+		    tm_items.width[idx], tm_items.height[idx]);
+}
+
+void tm_x_draw_items(struct tm_context *tc, int first, int nr)
+{
+	int i;
+
+	for (i = first; i < first + nr; i++)
+		tm_x_draw_item(tc, i);
+}
+
+/* Everything is to be redrawn. Copy the whole window at the next flush. */
+void tm_x_damage_all(struct tm_context *tc)
+{
+	cairo_rectangle_int_t r;
+	struct tm_x *x;
 
 	x = tm_x(tc);
+
+	r.x = r.y = 0;
+	r.width = x->width;
+	r.height = x->height;
+	cairo_region_union_rectangle(x->damage, &r);
+}
+
+/* Replace the path of @cr by the rectangles of @region. */
+static void tm_x_region_path(cairo_t *cr, const cairo_region_t *region)
+{
+	cairo_rectangle_int_t r;
+	int i, nr;
+
+	cairo_new_path(cr);
+
+	nr = cairo_region_num_rectangles(region);
+	for (i = 0; i < nr; i++) {
+		cairo_region_get_rectangle(region, i, &r);
+		cairo_rectangle(cr, r.x, r.y, r.width, r.height);
+	}
+}
+
+/* Clear the areas of all queued items with one paint, then draw them. */
+static void tm_x_draw_pending(struct tm_x *x)
+{
+	cairo_t *cr;
+	int i;
+
 	cr = x->cr;
-	layout = x->layout;
 
-	/* Clear existing area. */
-	tm_x_clear_area(x, item->x, item->y, item->width, item->height);
+	if (!x->nr_pending)
+		return;
+
+	cairo_save(cr);
+	cairo_identity_matrix(cr);
+	tm_x_region_path(cr, x->item_damage);
+	cairo_clip(cr);
+	tm_x_set_source_rgb(cr, x->x_bg);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	for (i = 0; i < x->nr_pending; i++) {
+		tm_x_draw_text(x, x->pending[i]);
+		x->queued[x->pending[i]] = false;
+	}
+
+	cairo_region_destroy(x->item_damage);
+	x->item_damage = cairo_region_create();
+	x->nr_pending = 0;
+}
+
+/* Draw queued items, and copy the damage of this frame onto the window with
+ * one clip and one paint.
+ */
+void tm_x_flush(struct tm_context *tc)
+{
+	cairo_rectangle_int_t r;
+	struct tm_x *x;
+	cairo_t *cr;
+	u64 start;
+	int i, nr;
 
-	if (!item->len)
+	x = tm_x(tc);
+	cr = x->win_cr;
+
+	tm_x_draw_pending(x);
+
+	/* Requests like map or move may still wait in the connection. */
+	if (cairo_region_is_empty(x->damage)) {
+		xcb_flush(x->c);
 		return;
+	}
 
-	tm_x_set_source_rgb(cr, item->fg);
+	start = tm_now();
 
-	dx = item->x;
-	pango_layout_set_text(layout, item->str, item->len);
-	if (item->flags & (TM_ITEM_WIDTH_CHANGEABLE | TM_ITEM_ALIGN_RIGHT)) {
-		int width;
+	cairo_surface_flush(x->surface);
 
-		pango_layout_get_pixel_size(layout, &width, NULL);
-		if (item->flags & TM_ITEM_WIDTH_CHANGEABLE)
-			item->width = (double)width;
-		else if (item->flags & TM_ITEM_ALIGN_RIGHT)
-			dx += item->width - (double)width;
+	nr = cairo_region_num_rectangles(x->damage);
+	for (i = 0; i < nr; i++) {
+		cairo_region_get_rectangle(x->damage, i, &r);
+		x->blit_pixels += (u64)r.width * r.height;
 	}
+	x->nr_blit_rects += nr;
+
+	cairo_save(cr);
+	tm_x_region_path(cr, x->damage);
+	cairo_clip(cr);
+	cairo_set_source_surface(cr, x->surface, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	cairo_surface_flush(x->win_surface);
+	xcb_flush(x->c);
+
+	cairo_region_destroy(x->damage);
+	x->damage = cairo_region_create();
 
-	cairo_move_to(cr, dx, item->y);
-	pango_cairo_show_layout(cr, layout);
+	x->nr_blits++;
+	x->blit_ns += tm_now() - start;
 }
 
-void tm_x_draw_text(struct tm_context *tc, struct tm_item *items,
-		    size_t nr_items)
+/* Render glyph atlases of all item colors, once all items are initialized,
+ * so that drawing never has to.
+ */
+void tm_x_glyph_prepare(struct tm_context *tc)
 {
-	int i;
+	struct tm_x *x;
+	int i, err;
+
+	x = tm_x(tc);
 
-	for (i = 0; i < nr_items; i++)
-		tm_x_draw_text_one(tc, &items[i]);
+	if (!x->use_glyph)
+		return;
+
+	for (i = 0; i < tm_items.nr; i++) {
+		u32 fg;
+
+		fg = tm_items.fg[i];
+
+		/* And its dimmed one, for stale items. */
+		err = tm_glyph_add_color(fg);
+		if (!err)
+			err = tm_glyph_add_color(tm_x_blend(fg, x->x_bg));
+		if (err) {
+			/* Colors left out are drawn by Pango. */
+			errno = err;
+			pr_err("tm_glyph_add_color");
+			break;
+		}
+	}
+}
+
+void tm_x_stats(struct tm_context *tc)
+{
+	struct tm_x *x;
+
+	x = tm_x(tc);
+
+	if (!x->nr_blits)
+		return;
+
+	fprintf(stderr, "blit: %llu frames, %.1f rects/frame, "
+		"%.0f pixels/frame, %.1f KiB/frame, %.1f us/frame\n",
+		(unsigned long long)x->nr_blits,
+		(double)x->nr_blit_rects / x->nr_blits,
+		(double)x->blit_pixels / x->nr_blits,
+		(double)x->blit_pixels * 4 / 1024 / x->nr_blits,
+		(double)x->blit_ns / 1000 / x->nr_blits);
+	fprintf(stderr, "text: %llu shaped, %llu cached\n",
+		(unsigned long long)x->nr_shaped,
+		(unsigned long long)x->nr_cached);
+	if (x->use_glyph)
+		tm_glyph_stats();
 }
 
 static int tm_x_parse_opts(struct tm_x *x, int argc, char **argv)
 {
 	int i, err;
+	long val;
 
 	err = 1;
 
@@ -471,6 +770,32 @@ static int tm_x_parse_opts(struct tm_x *x, int argc, char **argv)
 				goto out;
 			}
 			x->font_desc = argv[i];
+		} else if (!strcmp(argv[i], "--x_sched")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--x_sched needs argument.\n");
+				goto out;
+			}
+			x->sched.policy = argv[i];
+		} else if (!strcmp(argv[i], "--x_nice")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--x_nice needs argument.\n");
+				goto out;
+			}
+			if (tm_parse_num(argv[i - 1], argv[i], -20, 19, &val))
+				goto out;
+			x->sched.nice = val;
+			x->sched.set_nice = true;
+		} else if (!strcmp(argv[i], "--x_cpus")) {
+			if (++i >= argc) {
+				fprintf(stderr,
+					"--x_cpus needs argument.\n");
+				goto out;
+			}
+			x->sched.cpus = argv[i];
+		} else if (!strcmp(argv[i], "--disable_glyph_atlas")) {
+			x->use_glyph = false;
 		}
 	}
 
@@ -543,7 +868,9 @@ static int tm_x_create_window(struct tm_x *x)
 
 	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
 	values[0] = x->x_bg;
-	values[1] = XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_EXPOSURE;
+	values[1] = XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_EXPOSURE |
+		    XCB_EVENT_MASK_VISIBILITY_CHANGE |
+		    XCB_EVENT_MASK_STRUCTURE_NOTIFY;
 
 	xcb_create_window(c,
 	/* depth	*/XCB_COPY_FROM_PARENT,
@@ -664,6 +991,27 @@ static int tm_x_cairo_init(struct tm_x *x)
 	if (status != CAIRO_STATUS_SUCCESS)
 		goto out;
 
+	/* Blits are plain copies. */
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	x->win_cr = cr;
+	x->win_surface = surface;
+
+	/* Back buffer. Same depth as the window, so that copying it needs no
+	 * conversion.
+	 */
+	surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, x->width,
+					     x->height);
+	status = cairo_surface_status(surface);
+	if (status != CAIRO_STATUS_SUCCESS)
+		goto err;
+
+	cr = cairo_create(surface);
+	status = cairo_status(cr);
+	cairo_surface_destroy(surface);
+	if (status != CAIRO_STATUS_SUCCESS)
+		goto err;
+
 	cairo_set_antialias(cr, x->cairo_antialias);
 	cairo_set_line_width(cr, x->cairo_line_width);
 	cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
@@ -671,9 +1019,15 @@ static int tm_x_cairo_init(struct tm_x *x)
 	x->cr = cr;
 	x->surface = surface;
 
+	x->damage = cairo_region_create();
+	x->item_damage = cairo_region_create();
+
 	err = 0;
 out:
 	return err;
+err:
+	cairo_destroy(x->win_cr);
+	goto out;
 }
 
 static void tm_x_pango_init(struct tm_x *x)
@@ -905,7 +1259,7 @@ static int tm_x_event_key_press(struct tm_context *tc, const void *event)
 	e = event;
 
 	if (e->detail == 9)
-		tc->should_stop = true;
+		tm_stop(tc);
 
 	return 0;
 }
@@ -937,6 +1291,134 @@ static int tm_x_event_expose(struct tm_context *tc, const void *event)
 	return 0;
 }
 
+/* Sampling is pointless while nobody can see us. Let timers sleep. */
+static void tm_x_update_visibility(struct tm_context *tc)
+{
+	struct tm_x *x;
+
+	x = tm_x(tc);
+
+	if (x->unmapped || x->obscured)
+		tm_thread_suspend(tc);
+	else
+		tm_thread_resume(tc);
+}
+
+static int tm_x_event_visibility(struct tm_context *tc, const void *event)
+{
+	const xcb_visibility_notify_event_t *e;
+
+	e = event;
+
+	tm_x(tc)->obscured = e->state == XCB_VISIBILITY_FULLY_OBSCURED;
+	tm_x_update_visibility(tc);
+
+	return 0;
+}
+
+static int tm_x_handle_event(struct tm_context *tc, xcb_generic_event_t *e)
+{
+	int err, type;
+
+	err = 0;
+	/* Strip the bit telling the event came from SendEvent. */
+	type = e->response_type & ~0x80;
+
+	if (type == XCB_KEY_PRESS) {
+		err = tm_x_event_key_press(tc, e);
+	} else if (type == XCB_EXPOSE) {
+		/* Redraw all objects. */
+		err = tm_x_event_expose(tc, e);
+	} else if (type == XCB_VISIBILITY_NOTIFY) {
+		err = tm_x_event_visibility(tc, e);
+	} else if (type == XCB_MAP_NOTIFY || type == XCB_UNMAP_NOTIFY) {
+		tm_x(tc)->unmapped = type == XCB_UNMAP_NOTIFY;
+		tm_x_update_visibility(tc);
+	} else if (type == XCB_CLIENT_MESSAGE) {
+		/* Sent by tm_x_wake(). Nothing to do. */
+	} else if (type == XCB_CONFIGURE_NOTIFY ||
+		   type == XCB_REPARENT_NOTIFY ||
+		   type == XCB_GRAVITY_NOTIFY ||
+		   type == XCB_DESTROY_NOTIFY ||
+		   type == XCB_CIRCULATE_NOTIFY) {
+		/* Comes with StructureNotify. We don't care. */
+	} else {
+		fprintf(stderr, "response_type: %d\n", e->response_type);
+	}
+
+	return err;
+}
+
+/* Wake up tm_x_wait_events() blocking in xcb_wait_for_event() by sending an
+ * event to ourselves.
+ */
+void tm_x_wake(struct tm_context *tc)
+{
+	xcb_client_message_event_t ev;
+	struct tm_x *x;
+
+	x = tm_x(tc);
+
+	ev = (xcb_client_message_event_t){
+		.response_type	= XCB_CLIENT_MESSAGE,
+		.format		= 32,
+		.window		= x->win,
+		.type		= XCB_ATOM_NONE
+	};
+	/* Empty event mask sends it to the client which created window. */
+	xcb_send_event(x->c, 0, x->win, XCB_EVENT_MASK_NO_EVENT,
+		       (const char *)&ev);
+	xcb_flush(x->c);
+}
+
+static void tm_x_map_window(struct tm_context *tc)
+{
+	struct tm_x *x;
+
+	x = tm_x(tc);
+
+	/* Map the window. */
+	xcb_map_window(x->c, x->win);
+	tm_x_flush(tc);
+
+	/* WM may ignore x, y coordinates which are specified at window
+	 * creation time. Try once more after window is mapped.
+	 */
+	tm_x_move_window(x);
+	xcb_flush(x->c);
+}
+
+/* Single thread mode: called on event loop when X connection is readable,
+ * and before event loop goes to sleep. Never blocks.
+ */
+static int tm_x_poll_events(struct tm_context *tc)
+{
+	xcb_generic_event_t *e;
+	struct tm_x *x;
+	int err;
+
+	x = tm_x(tc);
+	err = 0;
+
+	while (!err && (e = xcb_poll_for_event(x->c))) {
+		err = tm_x_handle_event(tc, e);
+		free(e);
+	}
+
+	if (!err && xcb_connection_has_error(x->c)) {
+		fprintf(stderr, "X connection has error.\n");
+		err = 1;
+	}
+
+	return err;
+}
+
+/* Called by X event thread and by main thread before it starts drawing. */
+void tm_x_sched_apply(struct tm_context *tc, bool report)
+{
+	tm_thread_sched_apply("x", &tm_x(tc)->sched, report);
+}
+
 static void *tm_x_wait_events(void *data)
 {
 	struct tm_context *tc;
@@ -954,58 +1436,58 @@ static void *tm_x_wait_events(void *data)
 		pthread_cond_wait(&tc->init_cond, &tc->init_lock);
 	pthread_mutex_unlock(&tc->init_lock);
 
-	/* Map the window. */
-	xcb_map_window(c, x->win);
-	tm_x_flush(tc);
+	tm_x_sched_apply(tc, false);
 
-	/* WM may ignore x, y coordinates which are specified at window
-	 * creation time. Try once more after window is mapped.
-	 */
-	tm_x_move_window(x);
+	tm_x_map_window(tc);
 
 	err = 0;
 	/* Handle all X events. */
-	while (!tc->should_stop && !err) {
+	while (!tm_should_stop(tc) && !err) {
 		xcb_generic_event_t *e;
 
 		e = xcb_wait_for_event(c);
 
-		if (tc->should_stop)
+		if (tm_should_stop(tc)) {
+			free(e);
 			break;
+		}
 
 		if (!e) {
 			fprintf(stderr, "xcb_wait_for_event: NULL.\n");
 			err = 1;
-		} else if (e->response_type == XCB_KEY_PRESS) {
-			err = tm_x_event_key_press(tc, e);
-		} else if (e->response_type == XCB_EXPOSE) {
-			/* Redraw all objects. */
-			err = tm_x_event_expose(tc, e);
 		} else {
-			fprintf(stderr, "response_type: %d\n",
-				e->response_type);
+			err = tm_x_handle_event(tc, e);
 		}
 
 		free(e);
 	}
 
 	if (err)
-		tc->should_stop = true;
-
-	if (tc->should_stop)
-		pthread_cond_signal(&tc->main_wake_cond);
+		tm_stop(tc);
 
 	return NULL;
 }
 
 static void tm_x_destroy_pango(struct tm_x *x)
 {
+	int i;
+
+	for (i = 0; i < TM_ITEM_MAX; i++) {
+		if (x->texts[i].layout)
+			g_object_unref(x->texts[i].layout);
+	}
+
+	if (x->use_glyph)
+		tm_glyph_exit();
 	g_object_unref(x->layout);
 }
 
 static void tm_x_destroy_cairo(struct tm_x *x)
 {
+	cairo_region_destroy(x->damage);
+	cairo_region_destroy(x->item_damage);
 	cairo_destroy(x->cr);
+	cairo_destroy(x->win_cr);
 }
 
 static void tm_x_destroy_window(struct tm_x *x)
@@ -1039,6 +1521,7 @@ static int tm_x_init(struct tm_context *tc, int argc, char **argv)
 	x->icon_scale_factor = 2.2;
 	x->side_icon_scale_factor = 1.1;
 	x->font_desc = "sans-serif bold 18";
+	x->use_glyph = true;
 
 	err = tm_x_parse_opts(x, argc, argv);
 	if (err)
@@ -1067,12 +1550,27 @@ static int tm_x_init(struct tm_context *tc, int argc, char **argv)
 	tm_x_get_max_digit_width(x);
 	/* Calculate max unit width. */
 	tm_x_get_max_unit_width(x);
+	/* Measure glyphs of numbers for the atlas. */
+	if (x->use_glyph)
+		tm_glyph_init(x->layout);
 
 	/* Use shape-extension. */
 	err = tm_x_shape(x);
 	if (err)
 		goto err_destroy_pango;
 
+	/* In single thread mode, X events are handled on event loop. */
+	if (tc->single_thread) {
+		x->xfd = (struct tm_thread_fd){
+			.fd	= xcb_get_file_descriptor(x->c),
+			.fd_cb	= tm_x_poll_events,
+			.flags	= TM_THREAD_FD_PREPARE
+		};
+		tm_thread_fd_add(&x->xfd);
+		tm_x_map_window(tc);
+		goto out;
+	}
+
 	/* Create a thread which handles all X events. */
 	err = pthread_create(&x->tid_wait_ev, NULL, tm_x_wait_events, tc);
 	if (err) {
@@ -1097,7 +1595,10 @@ static void tm_x_exit(struct tm_context *tc)
 	x = tm_x(tc);
 
 	/* Wait for tm_x_wait_events joining. */
-	pthread_join(x->tid_wait_ev, NULL);
+	if (tc->single_thread)
+		tm_thread_fd_del(&x->xfd);
+	else
+		pthread_join(x->tid_wait_ev, NULL);
 
 	/* Free all resources. */
 	tm_x_destroy_pango(x);
@@ -1132,7 +1633,14 @@ static void tm_x_help(struct tm_context *tc)
 	       "\t\tSpecify how large the icon should be relative to font height.\n"
 	       "\t--font <FONT-DESCRIPTION>\n"
 	       "\t\te.g.: \"sans-serif bold 18\"\n"
-	       "\t\tSee https://developer.gnome.org/pango/stable/pango-Fonts.html#pango-font-description-from-string\n");
+	       "\t\tSee https://developer.gnome.org/pango/stable/pango-Fonts.html#pango-font-description-from-string\n"
+	       "\t--x_sched <other|batch|idle|fifo|rr>\n"
+	       "\t--x_nice <NICE>\n"
+	       "\t--x_cpus <CPU-LIST>\n"
+	       "\t\tScheduling of X and drawing threads. See --collector_*.\n"
+	       "\t--disable_glyph_atlas\n"
+	       "\t\tShape numbers with Pango too, instead of pre-rendered\n"
+	       "\t\tglyphs.\n");
 }
 
 static void tm_x_draw(struct tm_context *tc)
@@ -22,6 +22,11 @@ struct tm_icon {
 	__tm_x_load_icon(__tc, ICONSDIR __file, __type, __icon)
 
 extern void tm_x_flush(struct tm_context *tc);
+extern void tm_x_damage_all(struct tm_context *tc);
+extern void tm_x_stats(struct tm_context *tc);
+extern void tm_x_glyph_prepare(struct tm_context *tc);
+extern void tm_x_wake(struct tm_context *tc);
+extern void tm_x_sched_apply(struct tm_context *tc, bool report);
 extern u32 tm_x_get_color_from_str(const char *s);
 extern int tm_x_width(struct tm_context *tc);
 extern double tm_x_margin(struct tm_context *tc);
@@ -39,8 +44,7 @@ extern void tm_x_unload_icon(struct tm_icon *icon);
 extern void tm_x_draw_icon(struct tm_context *tc, struct tm_icon *icon,
 			   double pos_x, double pos_y);
 extern void tm_x_draw_line(struct tm_context *tc, double pos_x, double pos_y);
-extern void tm_x_draw_text_one(struct tm_context *tc, struct tm_item *item);
-extern void tm_x_draw_text(struct tm_context *tc, struct tm_item *items,
-			   size_t nr_items);
+extern void tm_x_draw_item(struct tm_context *tc, int idx);
+extern void tm_x_draw_items(struct tm_context *tc, int first, int nr);
 
 #endif /* _TM_X_H */